@@ -65,6 +65,15 @@ struct cmd_args
 	STRPTR	Source;
 	STRPTR	Destination;
 	LONG	Overwrite;
+	LONG *	WindowSize;
+	LONG *	Timeout;
+	STRPTR	List;
+	LONG *	Sessions;
+	LONG	Server;
+	STRPTR	Root;
+	LONG	Multicast;
+	LONG *	BufferSize;
+	STRPTR *	Pairs;
 };
 
 /****************************************************************************/
@@ -0,0 +1,355 @@
+/*
+ * :ts=4
+ *
+ * TFTP client program for the Amiga, using only the SANA-II network
+ * device driver API, and no TCP/IP stack
+ *
+ * The "trivial file transfer protocol" is anything but trivial
+ * to implement...
+ *
+ * Copyright  2016 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE. MY CAPS LOCK KEY SEEMS TO BE STUCK.
+ */
+
+/****************************************************************************/
+
+#include <exec/memory.h>
+#include <dos/dostags.h>
+
+/****************************************************************************/
+
+#define __USE_INLINE__
+#include <proto/exec.h>
+#include <proto/dos.h>
+
+#include <string.h>
+
+/****************************************************************************/
+
+#include "disk-writer.h"
+#include "compiler.h"
+
+/****************************************************************************/
+
+#include "macros.h"
+#include "assert.h"
+
+/****************************************************************************/
+
+/* The received data is written to the destination files by a process of
+ * its own, so that the file system does not hold up the acknowledgements.
+ * Each buffer full of data is handed over in a message, of which there is
+ * only a fixed number. The messages come back through the reply port once
+ * the data has been written.
+ */
+struct MsgPort * disk_write_reply_port;
+
+/* The message port of the disk writer process, which it creates for
+ * itself, and the process itself.
+ */
+static struct MsgPort * disk_writer_port;
+static struct Process * disk_writer_process;
+
+/* All the messages, and those which are currently not in use. */
+static struct disk_write_message *	disk_write_messages[DISK_WRITE_QUEUE_SIZE];
+static struct MinList				free_disk_write_list;
+
+/* This one tells the disk writer process to quit. */
+static struct disk_write_message	quit_message;
+
+/****************************************************************************/
+
+/* The disk writer process writes each buffer of data it receives, and
+ * then returns the message to the sender, along with an error code if
+ * the data could not be written. The buffers are large enough for the
+ * file system, which is why they bypass the dos.library buffering.
+ */
+static void SAVE_DS
+disk_writer_entry(void)
+{
+	struct Process * this_process = (struct Process *)FindTask(NULL);
+	struct disk_write_message * dwm;
+	struct Message * startup_message;
+	struct MsgPort * port;
+	BOOL done = FALSE;
+
+	/* The startup message tells us that the main process is ready,
+	 * and it is waiting for us to create our message port.
+	 */
+	WaitPort(&this_process->pr_MsgPort);
+	startup_message = GetMsg(&this_process->pr_MsgPort);
+
+	port = CreateMsgPort();
+
+	disk_writer_port = port;
+
+	/* If we cannot continue, the main process must not unload the
+	 * program before this process has exited.
+	 */
+	if(port == NULL)
+		Forbid();
+
+	ReplyMsg(startup_message);
+
+	while(port != NULL && NOT done)
+	{
+		WaitPort(port);
+
+		while((dwm = (struct disk_write_message *)GetMsg(port)) != NULL)
+		{
+			if(dwm->dwm_File == (BPTR)NULL)
+			{
+				DeleteMsgPort(port);
+				port = NULL;
+
+				Forbid();
+
+				ReplyMsg(&dwm->dwm_Message);
+
+				done = TRUE;
+				break;
+			}
+
+			SetIoErr(0);
+
+			if(Write(dwm->dwm_File,dwm->dwm_Data,dwm->dwm_Length) != dwm->dwm_Length)
+			{
+				dwm->dwm_Error = IoErr();
+				if(dwm->dwm_Error == 0)
+					dwm->dwm_Error = ERROR_DISK_FULL;
+			}
+			else
+			{
+				dwm->dwm_Error = 0;
+			}
+
+			ReplyMsg(&dwm->dwm_Message);
+		}
+	}
+}
+
+/****************************************************************************/
+
+/* Get hold of a message for data to be written. Returns NULL if all the
+ * messages are currently in use.
+ */
+struct disk_write_message *
+obtain_disk_write_message(void)
+{
+	struct disk_write_message * dwm;
+
+	dwm = (struct disk_write_message *)RemHead((struct List *)&free_disk_write_list);
+	if(dwm != NULL)
+	{
+		dwm->dwm_Data		= NULL;
+		dwm->dwm_Length		= 0;
+		dwm->dwm_Error		= 0;
+		dwm->dwm_UserData	= NULL;
+	}
+
+	return(dwm);
+}
+
+/****************************************************************************/
+
+/* Return a message which came back from the disk writer process, so that
+ * it may be used again.
+ */
+void
+release_disk_write_message(struct disk_write_message * dwm)
+{
+	ASSERT( dwm != NULL && dwm != &quit_message );
+
+	AddTail((struct List *)&free_disk_write_list,(struct Node *)dwm);
+}
+
+/****************************************************************************/
+
+/* Hand data over to the disk writer process. */
+void
+queue_disk_write(struct disk_write_message * dwm)
+{
+	ASSERT( dwm != NULL && dwm->dwm_File != (BPTR)NULL );
+	ASSERT( disk_writer_port != NULL );
+
+	PutMsg(disk_writer_port,&dwm->dwm_Message);
+}
+
+/****************************************************************************/
+
+/* Launch the disk writer process and allocate the messages which are
+ * used for handing the data over to it.
+ */
+int
+disk_writer_setup(BPTR error_output, const struct cmd_args * args)
+{
+	struct disk_write_message * dwm;
+	struct Message startup_message;
+	int result = FAILURE;
+	int i;
+
+	ENTER();
+
+	NewList((struct List *)&free_disk_write_list);
+
+	disk_write_reply_port = CreateMsgPort();
+	if(disk_write_reply_port == NULL)
+	{
+		if(!args->Quiet)
+			PrintFault(ERROR_NO_FREE_STORE,"TFTPClient");
+
+		D(("could not create disk writer reply port"));
+
+		goto out;
+	}
+
+	for(i = 0 ; i < DISK_WRITE_QUEUE_SIZE ; i++)
+	{
+		dwm = AllocVec(sizeof(*dwm), MEMF_ANY|MEMF_PUBLIC|MEMF_CLEAR);
+		if(dwm == NULL)
+		{
+			if(!args->Quiet)
+				PrintFault(ERROR_NO_FREE_STORE,"TFTPClient");
+
+			D(("could not allocate disk write message"));
+
+			goto out;
+		}
+
+		dwm->dwm_Message.mn_ReplyPort	= disk_write_reply_port;
+		dwm->dwm_Message.mn_Length		= sizeof(*dwm);
+
+		disk_write_messages[i] = dwm;
+
+		AddTail((struct List *)&free_disk_write_list,(struct Node *)dwm);
+	}
+
+	disk_writer_process = CreateNewProcTags(
+		NP_Entry,		disk_writer_entry,
+		NP_Name,		"TFTPClient disk writer",
+		NP_StackSize,	8192,
+	TAG_END);
+
+	if(disk_writer_process == NULL)
+	{
+		if(!args->Quiet)
+			FPrintf(error_output, "%s: Could not launch the disk writer process.\n","TFTPClient");
+
+		D(("Could not launch the disk writer process."));
+
+		goto out;
+	}
+
+	/* Wait for the disk writer process to set up its message port. */
+	memset(&startup_message,0,sizeof(startup_message));
+
+	startup_message.mn_ReplyPort	= disk_write_reply_port;
+	startup_message.mn_Length		= sizeof(startup_message);
+
+	PutMsg(&disk_writer_process->pr_MsgPort,&startup_message);
+
+	WaitPort(disk_write_reply_port);
+	GetMsg(disk_write_reply_port);
+
+	if(disk_writer_port == NULL)
+	{
+		/* The process has already quit. */
+		disk_writer_process = NULL;
+
+		if(!args->Quiet)
+			PrintFault(ERROR_NO_FREE_STORE,"TFTPClient");
+
+		D(("disk writer process could not create its message port"));
+
+		goto out;
+	}
+
+	result = OK;
+
+ out:
+
+	RETURN(result);
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Tell the disk writer process to quit, and release the messages. Any
+ * data which is still waiting to be written will be written first.
+ */
+void
+disk_writer_cleanup(void)
+{
+	struct disk_write_message * dwm;
+	int i;
+
+	ENTER();
+
+	if(disk_writer_process != NULL)
+	{
+		quit_message.dwm_Message.mn_ReplyPort	= disk_write_reply_port;
+		quit_message.dwm_Message.mn_Length		= sizeof(quit_message);
+		quit_message.dwm_File					= (BPTR)NULL;
+
+		PutMsg(disk_writer_port,&quit_message.dwm_Message);
+
+		/* The process handles the messages in order, which
+		 * is why the quit message comes back last.
+		 */
+		do
+		{
+			WaitPort(disk_write_reply_port);
+
+			dwm = (struct disk_write_message *)GetMsg(disk_write_reply_port);
+		}
+		while(dwm != &quit_message);
+
+		disk_writer_process = NULL;
+		disk_writer_port = NULL;
+	}
+
+	for(i = 0 ; i < DISK_WRITE_QUEUE_SIZE ; i++)
+	{
+		if(disk_write_messages[i] != NULL)
+		{
+			FreeVec(disk_write_messages[i]);
+			disk_write_messages[i] = NULL;
+		}
+	}
+
+	NewList((struct List *)&free_disk_write_list);
+
+	if(disk_write_reply_port != NULL)
+	{
+		DeleteMsgPort(disk_write_reply_port);
+		disk_write_reply_port = NULL;
+	}
+
+	LEAVE();
+}
@@ -0,0 +1,98 @@
+/*
+ * :ts=4
+ *
+ * TFTP client program for the Amiga, using only the SANA-II network
+ * device driver API, and no TCP/IP stack
+ *
+ * The "trivial file transfer protocol" is anything but trivial
+ * to implement...
+ *
+ * Copyright  2016 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE. MY CAPS LOCK KEY SEEMS TO BE STUCK.
+ */
+
+#ifndef _DISK_WRITER_H
+#define _DISK_WRITER_H
+
+/****************************************************************************/
+
+#ifndef EXEC_PORTS_H
+#include <exec/ports.h>
+#endif /* EXEC_PORTS_H */
+
+#ifndef DOS_DOS_H
+#include <dos/dos.h>
+#endif /* DOS_DOS_H */
+
+/****************************************************************************/
+
+#ifndef _ARGS_H
+#include "args.h"
+#endif /* _ARGS_H */
+
+/****************************************************************************/
+
+/* How many buffers full of received data may be waiting to be
+ * written at the same time. If all of them are in use, the next
+ * one has to wait until one of them has been written.
+ */
+#define DISK_WRITE_QUEUE_SIZE 16
+
+/****************************************************************************/
+
+/* Data to be written by the disk writer process, which belongs to the
+ * sender and must stay put until the message has been returned to the
+ * disk_write_reply_port.
+ */
+struct disk_write_message
+{
+	struct Message	dwm_Message;
+
+	BPTR			dwm_File;		/* File to write to; NULL tells the process to quit */
+	UBYTE *			dwm_Data;		/* Data to be written */
+	LONG			dwm_Length;		/* Number of bytes to be written */
+	LONG			dwm_Error;		/* IoErr() value if writing failed, 0 otherwise */
+	APTR			dwm_UserData;	/* Which transfer the data belongs to */
+};
+
+/****************************************************************************/
+
+extern struct MsgPort * disk_write_reply_port;
+
+/****************************************************************************/
+
+extern struct disk_write_message * obtain_disk_write_message(void);
+extern void release_disk_write_message(struct disk_write_message * dwm);
+extern void queue_disk_write(struct disk_write_message * dwm);
+extern int disk_writer_setup(BPTR error_output, const struct cmd_args * args);
+extern void disk_writer_cleanup(void);
+
+/****************************************************************************/
+
+#endif /* _DISK_WRITER_H */
@@ -0,0 +1,292 @@
+/*
+ * :ts=4
+ *
+ * TFTP client program for the Amiga, using only the SANA-II network
+ * device driver API, and no TCP/IP stack
+ *
+ * The "trivial file transfer protocol" is anything but trivial
+ * to implement...
+ *
+ * Copyright  2016 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE. MY CAPS LOCK KEY SEEMS TO BE STUCK.
+ */
+
+/****************************************************************************/
+
+#include <exec/memory.h>
+
+/****************************************************************************/
+
+#define __USE_INLINE__
+#include <proto/exec.h>
+#include <proto/dos.h>
+
+#include <string.h>
+
+/****************************************************************************/
+
+#include "file-image.h"
+
+/****************************************************************************/
+
+#include "macros.h"
+#include "assert.h"
+
+/****************************************************************************/
+
+/* The images loaded so far, and how much memory they take up. */
+static struct MinList	file_image_list;
+static BOOL				file_image_list_initialized;
+static ULONG			file_image_cache_size;
+
+/****************************************************************************/
+
+/* Free the memory used by an image, which must no longer be in use. */
+static void
+delete_file_image(struct file_image * fi)
+{
+	ASSERT( fi != NULL && fi->fi_UseCount == 0 );
+
+	Remove((struct Node *)fi);
+
+	file_image_cache_size -= fi->fi_Size;
+
+	if(fi->fi_Data != NULL)
+		FreeVec(fi->fi_Data);
+
+	if(fi->fi_Name != NULL)
+		FreeVec(fi->fi_Name);
+
+	FreeVec(fi);
+}
+
+/****************************************************************************/
+
+/* Make room for a new image of the given size by dropping the images
+ * which are not currently in use, oldest first. Returns TRUE if there
+ * is room enough, and FALSE otherwise.
+ */
+static BOOL
+make_room_for_file_image(ULONG size)
+{
+	struct file_image * fi;
+	struct file_image * next_fi;
+
+	for(fi = (struct file_image *)file_image_list.mlh_Head ;
+	    (next_fi = (struct file_image *)fi->fi_MinNode.mln_Succ) != NULL && file_image_cache_size + size > MAX_FILE_IMAGE_CACHE_SIZE ;
+	    fi = next_fi)
+	{
+		if(fi->fi_UseCount == 0)
+			delete_file_image(fi);
+	}
+
+	return((BOOL)(file_image_cache_size + size <= MAX_FILE_IMAGE_CACHE_SIZE));
+}
+
+/****************************************************************************/
+
+/* Load the contents of a file opened for reading into memory, unless this
+ * has already been done for the same file, in which case the image loaded
+ * before is used again. Returns NULL if the file is too large, or if there
+ * is not enough memory to hold it, in which case the file should be read
+ * block by block instead. The file position is left unchanged.
+ */
+struct file_image *
+obtain_file_image(const struct cmd_args * args, BPTR file)
+{
+	struct file_image * result = NULL;
+	struct FileInfoBlock * fib = NULL;
+	struct file_image * fi = NULL;
+	TEXT name[256];
+	LONG position;
+	LONG size;
+
+	ENTER();
+
+	if(NOT file_image_list_initialized)
+	{
+		NewList((struct List *)&file_image_list);
+		file_image_list_initialized = TRUE;
+	}
+
+	fib = AllocDosObject(DOS_FIB,NULL);
+	if(fib == NULL)
+		goto out;
+
+	if(NOT ExamineFH(file,fib) || NOT NameFromFH(file,name,sizeof(name)))
+		goto out;
+
+	if(fib->fib_Size <= 0 || fib->fib_Size > MAX_FILE_IMAGE_SIZE)
+		goto out;
+
+	/* Was the same file loaded before, and it has not been
+	 * changed since then?
+	 */
+	for(fi = (struct file_image *)file_image_list.mlh_Head ;
+	    fi->fi_MinNode.mln_Succ != NULL ;
+	    fi = (struct file_image *)fi->fi_MinNode.mln_Succ)
+	{
+		if(strcmp(fi->fi_Name,name) == 0 &&
+		   fi->fi_Size == (ULONG)fib->fib_Size &&
+		   CompareDates(&fi->fi_Date,&fib->fib_Date) == 0)
+		{
+			break;
+		}
+	}
+
+	if(fi->fi_MinNode.mln_Succ != NULL)
+	{
+		if(args->Verbose)
+			Printf("Using the copy of file \"%s\" loaded before.\n",name);
+
+		D(("Using the copy of file '%s' loaded before.",name));
+
+		/* Move it to the end of the list, so that it will
+		 * be the last to be dropped.
+		 */
+		Remove((struct Node *)fi);
+		AddTail((struct List *)&file_image_list,(struct Node *)fi);
+
+		fi->fi_UseCount++;
+
+		result = fi;
+		goto out;
+	}
+
+	/* The search ended up at the end of the list, which is not an
+	 * image that could be freed below.
+	 */
+	fi = NULL;
+
+	/* Leave enough memory for the rest of the program to work with. */
+	if((ULONG)fib->fib_Size > AvailMem(MEMF_ANY|MEMF_LARGEST) / 4)
+		goto out;
+
+	if(NOT make_room_for_file_image(fib->fib_Size))
+		goto out;
+
+	fi = AllocVec(sizeof(*fi),MEMF_ANY|MEMF_PUBLIC|MEMF_CLEAR);
+	if(fi == NULL)
+		goto out;
+
+	fi->fi_Name = AllocVec(strlen(name)+1,MEMF_ANY|MEMF_PUBLIC);
+	fi->fi_Data = AllocVec(fib->fib_Size,MEMF_ANY|MEMF_PUBLIC);
+	if(fi->fi_Name == NULL || fi->fi_Data == NULL)
+		goto out;
+
+	strcpy(fi->fi_Name,name);
+
+	fi->fi_Date = fib->fib_Date;
+	fi->fi_Size = fib->fib_Size;
+
+	/* Read the whole file in one go, straight into the image,
+	 * bypassing the file buffer.
+	 */
+	position = Seek(file,0,OFFSET_BEGINNING);
+	if(position == -1)
+		goto out;
+
+	size = Read(file,fi->fi_Data,fi->fi_Size);
+
+	Seek(file,position,OFFSET_BEGINNING);
+
+	if(size != (LONG)fi->fi_Size)
+		goto out;
+
+	if(args->Verbose)
+		Printf("Loaded file \"%s\" into memory (%lu bytes).\n",name,fi->fi_Size);
+
+	D(("Loaded file '%s' into memory (%lu bytes).",name,fi->fi_Size));
+
+	AddTail((struct List *)&file_image_list,(struct Node *)fi);
+	file_image_cache_size += fi->fi_Size;
+
+	fi->fi_UseCount = 1;
+
+	result = fi;
+	fi = NULL;
+
+ out:
+
+	if(fi != NULL && result == NULL)
+	{
+		if(fi->fi_Data != NULL)
+			FreeVec(fi->fi_Data);
+
+		if(fi->fi_Name != NULL)
+			FreeVec(fi->fi_Name);
+
+		FreeVec(fi);
+	}
+
+	if(fib != NULL)
+		FreeDosObject(DOS_FIB,fib);
+
+	RETURN(result);
+	return(result);
+}
+
+/****************************************************************************/
+
+/* The transfer which used the image is over. The image is kept for
+ * the next transfer of the same file.
+ */
+void
+release_file_image(struct file_image * fi)
+{
+	if(fi != NULL)
+	{
+		ASSERT( fi->fi_UseCount > 0 );
+
+		fi->fi_UseCount--;
+	}
+}
+
+/****************************************************************************/
+
+/* Free all the images loaded. None of them may still be in use. */
+void
+file_image_cleanup(void)
+{
+	struct file_image * fi;
+
+	ENTER();
+
+	if(file_image_list_initialized)
+	{
+		while((fi = (struct file_image *)file_image_list.mlh_Head)->fi_MinNode.mln_Succ != NULL)
+		{
+			fi->fi_UseCount = 0;
+
+			delete_file_image(fi);
+		}
+	}
+
+	LEAVE();
+}
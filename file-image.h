@@ -0,0 +1,93 @@
+/*
+ * :ts=4
+ *
+ * TFTP client program for the Amiga, using only the SANA-II network
+ * device driver API, and no TCP/IP stack
+ *
+ * The "trivial file transfer protocol" is anything but trivial
+ * to implement...
+ *
+ * Copyright  2016 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE. MY CAPS LOCK KEY SEEMS TO BE STUCK.
+ */
+
+#ifndef _FILE_IMAGE_H
+#define _FILE_IMAGE_H
+
+/****************************************************************************/
+
+#ifndef EXEC_NODES_H
+#include <exec/nodes.h>
+#endif /* EXEC_NODES_H */
+
+#ifndef DOS_DOS_H
+#include <dos/dos.h>
+#endif /* DOS_DOS_H */
+
+/****************************************************************************/
+
+#ifndef _ARGS_H
+#include "args.h"
+#endif /* _ARGS_H */
+
+/****************************************************************************/
+
+/* Files no larger than this may be loaded into memory as a whole,
+ * and all the images loaded may not take up more than this much
+ * memory together.
+ */
+#define MAX_FILE_IMAGE_SIZE			1048576
+#define MAX_FILE_IMAGE_CACHE_SIZE	4194304
+
+/****************************************************************************/
+
+/* The contents of a file which is being sent, loaded into memory as a
+ * whole. The image is kept after the transfer is over, so that the
+ * next transfer of the same file can use it, too.
+ */
+struct file_image
+{
+	struct MinNode		fi_MinNode;
+
+	STRPTR				fi_Name;		/* Full path name of the file */
+	struct DateStamp	fi_Date;		/* When the file was last changed */
+	ULONG				fi_Size;		/* Number of bytes in the file */
+	UBYTE *				fi_Data;		/* The file contents */
+	ULONG				fi_UseCount;	/* Number of transfers using the image */
+};
+
+/****************************************************************************/
+
+extern struct file_image * obtain_file_image(const struct cmd_args * args, BPTR file);
+extern void release_file_image(struct file_image * fi);
+extern void file_image_cleanup(void);
+
+/****************************************************************************/
+
+#endif /* _FILE_IMAGE_H */
@@ -81,6 +81,11 @@
 #include "error-codes.h"
 #include "testing.h"
 #include "timer.h"
+#include "rto.h"
+#include "quad.h"
+#include "transfer-list.h"
+#include "disk-writer.h"
+#include "file-image.h"
 #include "args.h"
 
 /****************************************************************************/
@@ -121,6 +126,8 @@ cleanup(void)
 {
 	ENTER();
 
+	disk_writer_cleanup();
+	file_image_cleanup();
 	network_cleanup();
 	timer_cleanup();
 	
@@ -181,75 +188,3067 @@ setup(BPTR error_output, const struct cmd_args * args)
 	if(timer_setup(error_output,args) != OK)
 		goto out;
 
+	#if defined(TESTING) && defined(TEST_CKSUM)
+	{
+		test_in_cksum(args);
+	}
+	#endif /* TESTING && TEST_CKSUM */
+
 	if(network_setup(error_output, args) != OK)
 		goto out;
 
-	result = OK;
+	result = OK;
+
+ out:
+
+	RETURN(result);
+	return(result);
+}
+
+/****************************************************************************/
+
+/* The size of the buffer used for reading from or writing to a file, in
+ * bytes. Unless the BUFFERSIZE parameter says otherwise, the size is
+ * picked to suit the transfer, but not smaller than the default, and
+ * not larger than the automatic limit.
+ */
+#define DEFAULT_FILE_BUFFER_SIZE	8192
+#define MIN_FILE_BUFFER_SIZE		512
+#define MAX_FILE_BUFFER_SIZE		1048576
+#define MAX_AUTO_FILE_BUFFER_SIZE	262144
+
+/****************************************************************************/
+
+/* These are shared by all the files to be transferred, and are set
+ * up by main() before the first transfer begins.
+ */
+static int		window_slot_size;
+static int		max_blksize;
+static int		requested_windowsize = DEFAULT_WINDOWSIZE;
+static ULONG	retransmit_timeout = DEFAULT_TIMEOUT;
+static int		default_server_udp_port_number = TFTP_PORT_NUMBER;
+static int		max_sessions = DEFAULT_SESSIONS;
+
+/* Set if the user wants to stop the program. */
+static BOOL		stop_transfers;
+
+/****************************************************************************/
+
+/* Each TFTP exchange rattles through the following
+ * steps until the transmission has completed or an
+ * error has occured.
+ */
+enum tftp_state_t
+{
+	tftp_state_request_ethernet_address,
+	tftp_state_request_read,
+	tftp_state_request_write,
+	tftp_state_write_to_file,
+	tftp_state_read_from_file,
+	tftp_state_option_acknowledgement,
+	tftp_state_finished,
+};
+
+/* Everything there is to know about a single file transfer. Several
+ * transfers may be active at the same time, and each one is identified
+ * by the UDP port number it uses on our side. When serving files, the
+ * roles are reversed: the "client" port number is still ours, and the
+ * "server" port number is the one the client uses.
+ */
+struct tftp_session
+{
+	struct MinNode			ts_MinNode;
+
+	struct transfer_node *	ts_transfer;		/* source and destination names */
+	BOOL					ts_server;			/* serving a client's request? */
+	STRPTR					ts_server_names;	/* file name requested by the client, and its path */
+	int						ts_num_retransmissions;
+	enum tftp_state_t		ts_state;
+	int						ts_result;			/* shell return code */
+	ULONG					ts_deadline;		/* when the timeout elapses, in milliseconds */
+
+	STRPTR					ts_local_filename;
+	STRPTR					ts_remote_filename;
+	ULONG					ts_from_ipv4_address;
+	STRPTR					ts_from_path;
+	ULONG					ts_to_ipv4_address;
+	STRPTR					ts_to_path;
+
+	ULONG					ts_remote_ipv4_address;
+	UBYTE					ts_remote_ethernet_address[SANA2_MAX_ADDR_BYTES];
+	int						ts_num_arp_resolution_attempts;
+
+	BPTR					ts_source_file;
+	struct file_image *		ts_file_image;		/* contents of the source file, if loaded as a whole */
+	BPTR					ts_destination_file;
+	BOOL					ts_delete_destination_file;
+	BOOL					ts_destination_file_preallocated;
+	BOOL					ts_transfer_size_known;
+	ULONG					ts_transfer_size;
+
+	int						ts_client_udp_port_number;
+	int						ts_server_udp_port_number;
+	BOOL					ts_server_udp_port_number_known;
+
+	struct tftp_options		ts_requested_options;
+	struct tftp_options		ts_accepted_options;
+	const struct tftp_options *	ts_options;
+	int						ts_blksize;
+	int						ts_windowsize;
+	int						ts_rollover;
+	struct rto_estimator	ts_rto;
+
+	UBYTE *					ts_window_buffer;	/* data packets not yet acknowledged, or read ahead */
+	int						ts_window_slot_length[2 * MAX_WINDOWSIZE];
+	ULONG					ts_window_slot_time[2 * MAX_WINDOWSIZE];
+	BOOL					ts_window_slot_resent[2 * MAX_WINDOWSIZE];
+	int						ts_first_unacknowledged_block;
+	int						ts_next_block_to_send;
+	int						ts_last_block_sent;
+	int						ts_last_block_read;
+	int						ts_final_block;
+	BOOL					ts_send_window;
+	ULONG					ts_num_blocks_sent;
+	ULONG					ts_num_stalled_blocks;	/* blocks which were not read ahead in time */
+	ULONG					ts_stall_time;		/* how long the server had to wait for them, in milliseconds */
+
+	int						ts_blocks_since_acknowledgement;
+	BOOL					ts_gap_acknowledged;
+	int						ts_block_number;
+	BOOL					ts_last_block_transmitted;
+	int						ts_num_eof_acknowledgements;
+	int						ts_num_pending_writes;	/* blocks the disk writer process has yet to write */
+	ULONG					ts_file_buffer_size;	/* 0 until the file is first read or written */
+	LONG					ts_file_system_block_size;
+
+	UBYTE *					ts_staging_buffer;	/* received data waiting to be written, in two halves */
+	ULONG					ts_staging_size;	/* size of each half */
+	int						ts_staging_half;	/* which half is being filled */
+	ULONG					ts_staging_used;
+	BOOL					ts_staging_pending[2];	/* half is being written by the disk writer process? */
+	ULONG					ts_num_staging_writes;
+
+	BOOL					ts_multicast;		/* data blocks arrive through a multicast group (RFC 2090)? */
+	BOOL					ts_master_client;	/* acknowledging the blocks on behalf of the group? */
+	ULONG					ts_multicast_ipv4_address;
+	int						ts_multicast_udp_port_number;
+	UBYTE *					ts_block_map;		/* one bit for each block received */
+	int						ts_multicast_final_block;
+	ULONG					ts_file_size;		/* how far the file has grown so far */
+
+	S2QUAD					ts_num_bytes_transferred;
+};
+
+/* The transfers which are currently in progress. */
+static struct MinList	session_list;
+
+/* When the timer will go off next, in milliseconds. */
+static ULONG			timer_deadline;
+
+/****************************************************************************/
+
+/* When sending a file, the window buffer holds the blocks of the current
+ * window, and as many blocks again which follow it. These are read from
+ * the file while the server is busy with the window, so that they are
+ * ready to go as soon as the window moves on.
+ */
+static int
+get_num_window_slots(const struct tftp_session * ts)
+{
+	return(2 * ts->ts_windowsize);
+}
+
+/****************************************************************************/
+
+/* Find the active transfer which uses a specific UDP port number on
+ * our side. Returns NULL if there is none.
+ */
+static struct tftp_session *
+find_session(int client_udp_port_number)
+{
+	struct tftp_session * result = NULL;
+	struct tftp_session * ts;
+
+	for(ts = (struct tftp_session *)session_list.mlh_Head ;
+	    ts->ts_MinNode.mln_Succ != NULL ;
+	    ts = (struct tftp_session *)ts->ts_MinNode.mln_Succ)
+	{
+		if(ts->ts_state != tftp_state_finished && ts->ts_client_udp_port_number == client_udp_port_number)
+		{
+			result = ts;
+			break;
+		}
+	}
+
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Find the active transfer which receives the data blocks sent to a
+ * multicast group and UDP port number. Returns NULL if there is none.
+ */
+static struct tftp_session *
+find_multicast_session(ULONG ipv4_address,int udp_port_number)
+{
+	struct tftp_session * result = NULL;
+	struct tftp_session * ts;
+
+	for(ts = (struct tftp_session *)session_list.mlh_Head ;
+	    ts->ts_MinNode.mln_Succ != NULL ;
+	    ts = (struct tftp_session *)ts->ts_MinNode.mln_Succ)
+	{
+		if(ts->ts_multicast && ts->ts_state != tftp_state_finished &&
+		   ts->ts_multicast_ipv4_address == ipv4_address && ts->ts_multicast_udp_port_number == udp_port_number)
+		{
+			result = ts;
+			break;
+		}
+	}
+
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Find the server session which is already busy with the request which a
+ * client sent from a specific IPv4 address and UDP port number. Returns
+ * NULL if there is none.
+ */
+static struct tftp_session *
+find_server_session(ULONG ipv4_address,int udp_port_number)
+{
+	struct tftp_session * result = NULL;
+	struct tftp_session * ts;
+
+	for(ts = (struct tftp_session *)session_list.mlh_Head ;
+	    ts->ts_MinNode.mln_Succ != NULL ;
+	    ts = (struct tftp_session *)ts->ts_MinNode.mln_Succ)
+	{
+		if(ts->ts_server && ts->ts_state != tftp_state_finished &&
+		   ts->ts_remote_ipv4_address == ipv4_address && ts->ts_server_udp_port_number == udp_port_number)
+		{
+			result = ts;
+			break;
+		}
+	}
+
+	return(result);
+}
+
+/****************************************************************************/
+
+/* The stages at which IP datagrams received may be rejected, and how many
+ * were rejected at each stage.
+ */
+enum ip_rejection_t
+{
+	ip_rejected_malformed,
+	ip_rejected_address,
+	ip_rejected_protocol,
+	ip_rejected_port,
+	ip_rejected_header_checksum,
+	ip_rejected_udp_checksum,
+	ip_rejected_icmp_checksum,
+
+	num_ip_rejection_stages
+};
+
+static ULONG num_ip_datagrams_received;
+static ULONG num_ip_datagrams_rejected[num_ip_rejection_stages];
+
+/****************************************************************************/
+
+/* Decide if an IP datagram received could be of interest, before any
+ * checksums are calculated. It must be addressed to this computer or to
+ * a multicast group which one of the transfers has joined, it must be a
+ * UDP datagram or an ICMP message, and a UDP datagram must be sent to a
+ * port which a transfer uses, or to the server port. Returns TRUE if the
+ * datagram should be looked at more closely, and FALSE otherwise.
+ */
+static BOOL
+classify_ip_datagram(const struct cmd_args * args,const struct NetIORequest * read_request)
+{
+	const struct ip * ip = read_request->nior_Buffer;
+	const struct udphdr * udp = (const struct udphdr *)&ip[1];
+	enum ip_rejection_t stage;
+	BOOL result = FALSE;
+	BOOL is_multicast;
+
+	num_ip_datagrams_received++;
+
+	/* This should be an IPv4 datagram without options, and
+	 * it should not claim to be larger than what arrived.
+	 */
+	if(read_request->nior_IOS2.ios2_DataLength < sizeof(*ip) ||
+	   ip->ip_v_hl != ((IPVERSION << 4) | 5) ||
+	   (UWORD)ip->ip_len < sizeof(*ip) ||
+	   (UWORD)ip->ip_len > read_request->nior_IOS2.ios2_DataLength)
+	{
+		stage = ip_rejected_malformed;
+		goto out;
+	}
+
+	/* The UDP datagram must fit into the IP datagram, too. */
+	if(ip->ip_pr == IPPROTO_UDP &&
+	   ((UWORD)ip->ip_len < sizeof(*ip) + sizeof(*udp) ||
+	    (UWORD)udp->uh_ulen < sizeof(*udp) ||
+	    (UWORD)udp->uh_ulen > (UWORD)ip->ip_len - sizeof(*ip)))
+	{
+		stage = ip_rejected_malformed;
+		goto out;
+	}
+
+	is_multicast = (BOOL)(ip->ip_pr == IPPROTO_UDP && (ip->ip_dst & 0xF0000000UL) == 0xE0000000UL &&
+	                      find_multicast_session(ip->ip_dst,udp->uh_dport) != NULL);
+
+	if(ip->ip_dst != local_ipv4_address && NOT is_multicast)
+	{
+		stage = ip_rejected_address;
+		goto out;
+	}
+
+	if(ip->ip_pr != IPPROTO_UDP && ip->ip_pr != IPPROTO_ICMP)
+	{
+		stage = ip_rejected_protocol;
+		goto out;
+	}
+
+	if(ip->ip_pr == IPPROTO_UDP && NOT is_multicast && find_session(udp->uh_dport) == NULL &&
+	   NOT (args->Server && udp->uh_dport == default_server_udp_port_number))
+	{
+		stage = ip_rejected_port;
+		goto out;
+	}
+
+	result = TRUE;
+
+ out:
+
+	if(NOT result)
+	{
+		num_ip_datagrams_rejected[stage]++;
+
+		D(("Ignoring IP datagram (rejected at stage %ld).",stage));
+	}
+
+	return(result);
+}
+
+/****************************************************************************/
+
+/* We need to send UDP datagrams using a specific port number, which
+ * uniquely identifies the TFTP session. This picks an "ephemeral"
+ * port number, which should be in the range 49152..65535, and which
+ * no other transfer in progress is using.
+ */
+static int
+pick_client_udp_port_number(void)
+{
+	int client_udp_port_number;
+
+	do
+	{
+		if(UtilityBase != NULL && UtilityBase->lib_Version >= 39)
+		{
+			/* Really use a unique ID. */
+			client_udp_port_number = 49152 + (GetUniqueID() % 16384);
+		}
+		else
+		{
+			/* Try to get by with a pseudo-randomly chosen port. */
+			client_udp_port_number = 49152 + (rand() % 16384);
+		}
+	}
+	while(find_session(client_udp_port_number) != NULL);
+
+	return(client_udp_port_number);
+}
+
+/****************************************************************************/
+
+/* All outgoing datagrams are addressed to the remote computer which the
+ * network I/O code knows about. This makes sure that it is the server
+ * which the session is talking to.
+ */
+static void
+select_session(const struct tftp_session * ts)
+{
+	remote_ipv4_address = ts->ts_remote_ipv4_address;
+
+	memmove(remote_ethernet_address,ts->ts_remote_ethernet_address,sizeof(remote_ethernet_address));
+}
+
+/****************************************************************************/
+
+/* Make a note of when the session needs attention again, unless
+ * the server responds in time.
+ */
+static void
+start_session_timer(struct tftp_session * ts,ULONG milliseconds)
+{
+	ts->ts_deadline = get_milliseconds() + milliseconds;
+}
+
+/****************************************************************************/
+
+/* There is only one timer, which has to go off when the first of the
+ * sessions in progress needs attention again. This restarts the timer
+ * if necessary.
+ */
+static void
+schedule_session_timer(void)
+{
+	const struct tftp_session * ts;
+	BOOL have_deadline = FALSE;
+	ULONG deadline = 0;
+	LONG delay;
+
+	for(ts = (struct tftp_session *)session_list.mlh_Head ;
+	    ts->ts_MinNode.mln_Succ != NULL ;
+	    ts = (struct tftp_session *)ts->ts_MinNode.mln_Succ)
+	{
+		if(ts->ts_state == tftp_state_finished)
+			continue;
+
+		/* The millisecond counter may wrap around, which is
+		 * why only the difference between the deadlines
+		 * counts.
+		 */
+		if(NOT have_deadline || (LONG)(ts->ts_deadline - deadline) < 0)
+		{
+			deadline = ts->ts_deadline;
+			have_deadline = TRUE;
+		}
+	}
+
+	if(have_deadline && (NOT time_in_use || deadline != timer_deadline))
+	{
+		delay = (LONG)(deadline - get_milliseconds());
+		if(delay < 1)
+			delay = 1;
+
+		D(("starting the timer"));
+
+		start_time(delay);
+
+		timer_deadline = deadline;
+	}
+}
+
+/****************************************************************************/
+
+/* Send the read or write request which begins the TFTP exchange, now that
+ * the Ethernet address of the server is known.
+ */
+static void
+begin_session_request(const struct cmd_args * args,struct tftp_session * ts)
+{
+	ENTER();
+
+	select_session(ts);
+
+	if(args->Verbose)
+		Printf("Trying to begin transmission of file \"%s\".\n", ts->ts_local_filename);
+
+	D(("Trying to begin transmission of file '%s'.", ts->ts_local_filename));
+
+	ts->ts_state = (ts->ts_from_ipv4_address == 0) ? tftp_state_request_write : tftp_state_request_read;
+
+	start_tftp(ts->ts_state == tftp_state_request_write ? TFTP_PACKET_WRQ : TFTP_PACKET_RRQ,
+		ts->ts_remote_filename,ts->ts_options,ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+
+	rto_start_timing(&ts->ts_rto);
+
+	D(("starting the timer"));
+
+	start_session_timer(ts,ts->ts_rto.re_rto);
+
+	LEAVE();
+}
+
+/****************************************************************************/
+
+/* Get ready to transfer a single file to or from the TFTP server. The
+ * source and destination names are given in the same form as the FROM and
+ * TO command line parameters. Returns OK if the transfer is under way, and
+ * FAILURE otherwise, in which case the session result will tell why.
+ */
+static int
+start_session(BPTR error_output,const struct cmd_args * args,struct tftp_session * ts)
+{
+	int result = FAILURE;
+	STRPTR source = ts->ts_transfer->tn_Source;
+	STRPTR destination = ts->ts_transfer->tn_Destination;
+	char ipv4_address[20];
+	const char * from_computer;
+	const char * to_computer;
+
+	ENTER();
+
+	ASSERT( args != NULL && source != NULL && destination != NULL );
+
+	ts->ts_state						= tftp_state_request_ethernet_address;
+	ts->ts_result						= RETURN_FAIL;
+	ts->ts_num_arp_resolution_attempts	= 4;
+	ts->ts_server_udp_port_number		= default_server_udp_port_number;
+	ts->ts_options						= &ts->ts_requested_options;
+	ts->ts_blksize						= SEGSIZE;
+	ts->ts_windowsize					= 1;
+	ts->ts_first_unacknowledged_block	= 1;
+	ts->ts_next_block_to_send			= 1;
+	ts->ts_block_number					= 1;
+	ts->ts_num_eof_acknowledgements		= 3;
+
+	/* The source is either a file name ("example"), or a file name with
+	 * an IPv4 address prefix, like a device name ("192.168.0.1:example").
+	 */
+	get_ipv4_address_and_path_from_name(source, &ts->ts_from_ipv4_address, &ts->ts_from_path);
+
+	if(ts->ts_from_ipv4_address == local_ipv4_address || ts->ts_from_ipv4_address == 0x7F000001)
+		ts->ts_from_ipv4_address = 0;
+
+	/* The file name is mandatory. */
+	if((*ts->ts_from_path) == '\0')
+	{
+		if(!args->Quiet)
+			FPrintf(error_output, "%s: FROM argument \"%s\" must include a file name.\n","TFTPClient", source);
+
+		goto out;
+	}
+
+	/* The destination is either a file name ("example"), or a file name with
+	 * an IPv4 address prefix, like a device name ("192.168.0.1:example").
+	 */
+	get_ipv4_address_and_path_from_name(destination, &ts->ts_to_ipv4_address, &ts->ts_to_path);
+
+	if((*ts->ts_to_path) == '\0')
+		ts->ts_to_path = (STRPTR)FilePart(ts->ts_from_path);
+
+	if(ts->ts_to_ipv4_address == local_ipv4_address || ts->ts_to_ipv4_address == 0x7F000001)
+		ts->ts_to_ipv4_address = 0;
+
+	if(ts->ts_to_ipv4_address == 0xFFFFFFFFUL)
+	{
+		if(!args->Quiet)
+			FPrintf(error_output, "%s: '%s' is not a valid IPv4 destination address.\n","TFTPClient",destination);
+
+		goto out;
+	}
+
+	if(ts->ts_from_ipv4_address != 0 && ts->ts_to_ipv4_address != 0)
+	{
+		if(!args->Quiet)
+			FPrintf(error_output, "%s: Please provide a source or destination IPv4 address, but not both.\n","TFTPClient");
+
+		goto out;
+	}
+
+	if(ts->ts_from_ipv4_address == ts->ts_to_ipv4_address)
+	{
+		if(!args->Quiet)
+			FPrintf(error_output, "%s: Please provide either a source or destination IPv4 address.\n","TFTPClient");
+
+		goto out;
+	}
+
+	if(ts->ts_from_ipv4_address != 0)
+	{
+		ts->ts_local_filename		= ts->ts_to_path;
+		ts->ts_remote_ipv4_address	= ts->ts_from_ipv4_address;
+		ts->ts_remote_filename		= ts->ts_from_path;
+	}
+	else
+	{
+		ts->ts_local_filename		= ts->ts_from_path;
+		ts->ts_remote_ipv4_address	= ts->ts_to_ipv4_address;
+		ts->ts_remote_filename		= ts->ts_to_path;
+	}
+
+	/* Make sure that the file name is not too long to be transmitted safely. */
+	if(strlen(ts->ts_remote_filename) + 1 + strlen("octet") + 1 > SEGSIZE)
+	{
+		if(!args->Quiet)
+		{
+			FPrintf(error_output, "%s: File name \"%s\" is too long (up to %ld characters are allowed).\n","TFTPClient",
+				ts->ts_remote_filename,SEGSIZE - (1 + strlen("octet") + 1));
+		}
+
+		goto out;
+	}
+
+	memset(&ts->ts_requested_options,0,sizeof(ts->ts_requested_options));
+
+	if(max_blksize > SEGSIZE)
+		ts->ts_requested_options.to_blksize = max_blksize;
+
+	if(requested_windowsize > 1)
+		ts->ts_requested_options.to_windowsize = requested_windowsize;
+
+	/* The server can only be told about the timeout in full seconds. */
+	ts->ts_requested_options.to_timeout = (retransmit_timeout + 999) / 1000;
+
+	/* Files with more than 65535 blocks can only be transmitted
+	 * if the block numbers start over. Most servers continue with
+	 * block 0, which is what we ask for, but some prefer block 1.
+	 */
+	ts->ts_requested_options.to_use_rollover	= TRUE;
+	ts->ts_requested_options.to_rollover		= 0;
+
+	/* A file to be received may be sent to a whole group of clients
+	 * at the same time (RFC 2090). Since the clients all have to
+	 * agree on which blocks are which, block numbers cannot start
+	 * over, and only a single block may be in flight at a time.
+	 */
+	if(args->Multicast && ts->ts_from_ipv4_address != 0)
+	{
+		ts->ts_requested_options.to_use_multicast	= TRUE;
+		ts->ts_requested_options.to_windowsize		= 0;
+		ts->ts_requested_options.to_use_rollover	= FALSE;
+	}
+
+	/* The retransmission timeout will adapt to how quickly the
+	 * server responds, starting with the one requested.
+	 */
+	rto_init(&ts->ts_rto,retransmit_timeout);
+
+	if(ts->ts_from_ipv4_address == 0)
+	{
+		sprintf(ipv4_address,"%lu.%lu.%lu.%lu",
+			(ts->ts_to_ipv4_address >> 24) & 0xff,
+			(ts->ts_to_ipv4_address >> 16) & 0xff,
+			(ts->ts_to_ipv4_address >>  8) & 0xff,
+			 ts->ts_to_ipv4_address        & 0xff);
+
+		from_computer	= "this computer";
+		to_computer		= ipv4_address;
+	}
+	else
+	{
+		sprintf(ipv4_address,"%lu.%lu.%lu.%lu",
+			(ts->ts_from_ipv4_address >> 24) & 0xff,
+			(ts->ts_from_ipv4_address >> 16) & 0xff,
+			(ts->ts_from_ipv4_address >>  8) & 0xff,
+			 ts->ts_from_ipv4_address        & 0xff);
+
+		from_computer	= ipv4_address;
+		to_computer		= "this computer";
+	}
+
+	if(args->Verbose)
+	{
+		Printf("Copy \"%s\" (%s) to \"%s\" (%s)\n",
+			ts->ts_from_path,
+			from_computer,
+			ts->ts_to_path,
+			to_computer);
+	}
+
+	D(("Will copy \"%s\" (%s) to \"%s\" (%s).",
+		ts->ts_from_path,
+		from_computer,
+		ts->ts_to_path,
+		to_computer
+	));
+
+	/* We are sending a file? */
+	if(ts->ts_from_ipv4_address == 0)
+	{
+		ts->ts_source_file = Open(ts->ts_from_path, MODE_OLDFILE);
+		if(ts->ts_source_file == (BPTR)NULL)
+		{
+			TEXT error_message[256];
+
+			Fault(IoErr(),NULL,error_message,sizeof(error_message));
+
+			if(!args->Quiet)
+				FPrintf(error_output, "%s: Could not open file \"%s\" for reading (%s).\n","TFTPClient",ts->ts_from_path,error_message);
+
+			D(("Could not open file '%s' for reading (%s).",ts->ts_from_path,error_message));
+
+			goto out;
+		}
+
+		D(("Opened '%s' for reading.", ts->ts_from_path));
+
+		/* Tell the server how large the file is going to be (RFC 2349),
+		 * so that it may refuse to receive it early on.
+		 */
+		if(Seek(ts->ts_source_file,0,OFFSET_END) != -1)
+		{
+			LONG file_size;
+
+			file_size = Seek(ts->ts_source_file,0,OFFSET_BEGINNING);
+			if(file_size != -1)
+			{
+				ts->ts_requested_options.to_use_tsize	= TRUE;
+				ts->ts_requested_options.to_tsize		= file_size;
+			}
+		}
+
+		/* If the file is small enough, the blocks to be sent
+		 * will be taken straight from its contents in memory.
+		 */
+		ts->ts_file_image = obtain_file_image(args,ts->ts_source_file);
+
+		/* Room for the blocks which the server has yet to acknowledge. */
+		ts->ts_window_buffer = AllocVec(window_slot_size * 2 * requested_windowsize, MEMF_ANY|MEMF_PUBLIC);
+		if(ts->ts_window_buffer == NULL)
+		{
+			if(!args->Quiet)
+				PrintFault(ERROR_NO_FREE_STORE,"TFTPClient");
+
+			D(("Could not allocate window buffer."));
+
+			goto out;
+		}
+	}
+	/* We are receiving a file. */
+	else
+	{
+		/* Unless specifically requested, we verify that the
+		 * file to write to does not yet exist and exit with
+		 * error if does.
+		 */
+		if(!args->Overwrite)
+		{
+			BPTR test_lock;
+
+			test_lock = Lock(ts->ts_to_path, EXCLUSIVE_LOCK);
+			if(test_lock == (BPTR)NULL)
+			{
+				/* It's acceptable if the file in question does
+				 * not exist yet. But everything else we count
+				 * as an error, report it and abort.
+				 */
+				if(IoErr() != ERROR_OBJECT_NOT_FOUND)
+				{
+					TEXT error_message[256];
+
+					Fault(IoErr(),NULL,error_message,sizeof(error_message));
+
+					if(!args->Quiet)
+						FPrintf(error_output, "%s: Could not check if file \"%s\" exists (%s).\n","TFTPClient",ts->ts_to_path,error_message);
+
+					D(("Could not check if file '%s' exists (%s).",ts->ts_to_path,error_message));
+
+					goto out;
+				}
+			}
+			/* The file already exists. */
+			else
+			{
+				UnLock(test_lock);
+
+				if(!args->Quiet)
+					Printf("%s: Destination file \"%s\" already exists. Use OVERWRITE argument to replace it.\n","TFTPClient",ts->ts_to_path);
+
+				D(("Destination file '%s' already exists.",ts->ts_to_path));
+
+				ts->ts_result = RETURN_WARN;
+				goto out;
+			}
+		}
+
+		/* This will either create or overwrite the file. */
+		ts->ts_destination_file = Open(ts->ts_to_path, MODE_NEWFILE);
+		if(ts->ts_destination_file == (BPTR)NULL)
+		{
+			TEXT error_message[256];
+
+			Fault(IoErr(),NULL,error_message,sizeof(error_message));
+
+			if(!args->Quiet)
+				FPrintf(error_output, "%s: Could not open file \"%s\" for writing (%s).\n","TFTPClient",ts->ts_to_path,error_message);
+
+			D(("Could not open file '%s' for writing (%s).",ts->ts_to_path,error_message));
+
+			goto out;
+		}
+		
+		D(("Opened '%s' for writing.", ts->ts_to_path));
+
+		/* Ask the server to tell us how large the file is (RFC 2349). */
+		ts->ts_requested_options.to_use_tsize = TRUE;
+
+		/* Delete an empty file. */
+		ts->ts_delete_destination_file = TRUE;
+	}
+
+	ts->ts_client_udp_port_number = pick_client_udp_port_number();
+
+	D(("client udp port number = %ld", ts->ts_client_udp_port_number));
+
+	/* We need to know the Ethernet address corresponding to the IPv4
+	 * address of the remote TFTP server. If a previous transfer already
+	 * asked for it, we can begin right away.
+	 */
+	if(find_arp_cache_entry(ts->ts_remote_ipv4_address,ts->ts_remote_ethernet_address))
+	{
+		begin_session_request(args,ts);
+	}
+	else
+	{
+		if(args->Verbose)
+			Printf("Sending ARP query...\n");
+
+		SHOWMSG("Sending ARP query.");
+
+		broadcast_arp_query(ts->ts_remote_ipv4_address);
+
+		D(("starting the timer"));
+
+		start_session_timer(ts,ARP_QUERY_TIMEOUT);
+	}
+
+	result = OK;
+
+ out:
+
+	RETURN(result);
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Now that we know how large the file to be received will be, make room
+ * for it in one go rather than letting the file grow block by block. Not
+ * every file system supports this, which is why a failure is not an error.
+ */
+static void
+preallocate_destination_file(const struct cmd_args * args,struct tftp_session * ts)
+{
+	if(ts->ts_transfer_size_known && ts->ts_transfer_size > 0)
+	{
+		if(SetFileSize(ts->ts_destination_file,ts->ts_transfer_size,OFFSET_BEGINNING) != -1 &&
+		   Seek(ts->ts_destination_file,0,OFFSET_BEGINNING) != -1)
+		{
+			ts->ts_destination_file_preallocated = TRUE;
+
+			if(args->Verbose)
+				Printf("Preallocated %lu bytes for file \"%s\".\n",ts->ts_transfer_size,ts->ts_to_path);
+
+			D(("Preallocated %lu bytes for file '%s'.",ts->ts_transfer_size,ts->ts_to_path));
+		}
+	}
+}
+
+/****************************************************************************/
+
+/* Get ready to serve a read or write request which a client sent to
+ * the TFTP port. Returns OK if the transfer is under way, and FAILURE
+ * otherwise, in which case the client will have been told why, if
+ * possible.
+ */
+static int
+start_server_session(BPTR error_output,const struct cmd_args * args,struct tftp_session * ts,
+	const struct ip * ip,const struct udphdr * udp,const UBYTE * ethernet_address)
+{
+	const struct tftphdr * tftp = (struct tftphdr *)&udp[1];
+	int length = udp->uh_ulen - sizeof(*udp);
+	const struct tftp_options * requested = &ts->ts_requested_options;
+	struct tftp_options * accepted = &ts->ts_accepted_options;
+	const char * file_name;
+	const char * name;
+	STRPTR root = (args->Root != NULL) ? args->Root : (STRPTR)"";
+	STRPTR path;
+	int path_size;
+	char ipv4_address[20];
+	int result = FAILURE;
+
+	ENTER();
+
+	ts->ts_server						= TRUE;
+	ts->ts_result						= RETURN_FAIL;
+	ts->ts_blksize						= SEGSIZE;
+	ts->ts_windowsize					= 1;
+	ts->ts_first_unacknowledged_block	= 1;
+	ts->ts_next_block_to_send			= 1;
+	ts->ts_block_number					= 1;
+	ts->ts_num_eof_acknowledgements		= 3;
+
+	/* The read request tells us where the client is, so there
+	 * is no need to ask for its Ethernet address.
+	 */
+	ts->ts_remote_ipv4_address = ip->ip_src;
+	memmove(ts->ts_remote_ethernet_address,ethernet_address,sizeof(ts->ts_remote_ethernet_address));
+
+	update_arp_cache(ts->ts_remote_ipv4_address,ts->ts_remote_ethernet_address);
+
+	/* This is important: the client's tftp session is bound to
+	 * the port number it sent the request from, and we need to
+	 * pick a port number of our own for it.
+	 */
+	ts->ts_server_udp_port_number		= udp->uh_sport;
+	ts->ts_server_udp_port_number_known	= TRUE;
+	ts->ts_client_udp_port_number		= pick_client_udp_port_number();
+
+	D(("client udp port number = %ld", ts->ts_client_udp_port_number));
+
+	select_session(ts);
+
+	sprintf(ipv4_address,"%lu.%lu.%lu.%lu",
+		(ts->ts_remote_ipv4_address >> 24) & 0xff,
+		(ts->ts_remote_ipv4_address >> 16) & 0xff,
+		(ts->ts_remote_ipv4_address >>  8) & 0xff,
+		 ts->ts_remote_ipv4_address        & 0xff);
+
+	if(parse_tftp_request(tftp,length,&file_name,&ts->ts_requested_options) != OK)
+	{
+		if(args->Verbose)
+			Printf("Rejecting unsupported request from client %s.\n",ipv4_address);
+
+		D(("Rejecting unsupported request from client %s.",ipv4_address));
+
+		send_tftp_error(TFTP_ERROR_BADOP,"Only octet mode transfers are supported",ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+		goto out;
+	}
+
+	/* The request will be reused for receiving the next datagram, which
+	 * is why we need to keep a copy of the file name. The path of the
+	 * file to be sent or received goes right behind it.
+	 */
+	path_size = strlen(root) + 1 + strlen(file_name) + 1;
+
+	ts->ts_server_names = AllocVec(strlen(file_name) + 1 + path_size, MEMF_ANY|MEMF_PUBLIC);
+	if(ts->ts_server_names == NULL)
+	{
+		D(("Could not allocate file name buffer."));
+
+		send_tftp_error(TFTP_ERROR_UNDEF,"Not enough memory",ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+		goto out;
+	}
+
+	strcpy(ts->ts_server_names,file_name);
+
+	path = &ts->ts_server_names[strlen(file_name) + 1];
+
+	/* Clients tend to ask for absolute paths, which we treat as
+	 * relative to the ROOT directory. The client must not be able
+	 * to reach beyond it, though.
+	 */
+	name = file_name;
+	while((*name) == '/')
+		name++;
+
+	strcpy(path,root);
+
+	if((*name) == '\0' || strchr(name,':') != NULL || strstr(name,"//") != NULL || NOT AddPart(path,(STRPTR)name,path_size))
+	{
+		if(args->Verbose)
+			Printf("Client %s may not access file \"%s\".\n",ipv4_address,file_name);
+
+		D(("Client %s may not access file '%s'.",ipv4_address,file_name));
+
+		send_tftp_error(TFTP_ERROR_ACCESS,"Access violation",ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+		goto out;
+	}
+
+	ts->ts_remote_filename	= ts->ts_server_names;
+	ts->ts_local_filename	= path;
+
+	memset(accepted,0,sizeof(*accepted));
+
+	/* Does the client want to receive a file? */
+	if(tftp->th_opcode == TFTP_PACKET_RRQ)
+	{
+		if(args->Verbose)
+			Printf("Client %s asks for file \"%s\".\n",ipv4_address,path);
+
+		D(("Client %s asks for file '%s'.",ipv4_address,path));
+
+		ts->ts_from_path = path;
+
+		ts->ts_source_file = Open(path, MODE_OLDFILE);
+		if(ts->ts_source_file == (BPTR)NULL)
+		{
+			LONG error = IoErr();
+
+			if(args->Verbose)
+				PrintFault(error,path);
+
+			if(error == ERROR_OBJECT_NOT_FOUND)
+				send_tftp_error(TFTP_ERROR_NOTFOUND,"File not found",ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+			else
+				send_tftp_error(TFTP_ERROR_ACCESS,"Cannot open file",ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+
+			goto out;
+		}
+
+		/* Room for the blocks which the client has yet to acknowledge. */
+		ts->ts_window_buffer = AllocVec(window_slot_size * 2 * requested_windowsize, MEMF_ANY|MEMF_PUBLIC);
+		if(ts->ts_window_buffer == NULL)
+		{
+			D(("Could not allocate window buffer."));
+
+			send_tftp_error(TFTP_ERROR_UNDEF,"Not enough memory",ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+			goto out;
+		}
+
+		/* Tell the client how large the file is (RFC 2349). */
+		if(requested->to_use_tsize && Seek(ts->ts_source_file,0,OFFSET_END) != -1)
+		{
+			LONG file_size;
+
+			file_size = Seek(ts->ts_source_file,0,OFFSET_BEGINNING);
+			if(file_size != -1)
+			{
+				accepted->to_use_tsize	= TRUE;
+				accepted->to_tsize		= file_size;
+			}
+		}
+
+		/* The same file may be asked for again and again, in
+		 * which case its contents need to be read only once.
+		 */
+		ts->ts_file_image = obtain_file_image(args,ts->ts_source_file);
+	}
+	/* The client wants to send a file. */
+	else
+	{
+		if(args->Verbose)
+			Printf("Client %s wants to send file \"%s\".\n",ipv4_address,path);
+
+		D(("Client %s wants to send file '%s'.",ipv4_address,path));
+
+		ts->ts_to_path = path;
+
+		/* Unless specifically permitted, existing files
+		 * will not be replaced.
+		 */
+		if(!args->Overwrite)
+		{
+			BPTR test_lock;
+
+			test_lock = Lock(path, SHARED_LOCK);
+			if(test_lock != (BPTR)NULL)
+			{
+				UnLock(test_lock);
+
+				send_tftp_error(TFTP_ERROR_EXISTS,"File already exists",ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+				goto out;
+			}
+		}
+
+		ts->ts_destination_file = Open(path, MODE_NEWFILE);
+		if(ts->ts_destination_file == (BPTR)NULL)
+		{
+			if(args->Verbose)
+				PrintFault(IoErr(),path);
+
+			send_tftp_error(TFTP_ERROR_ACCESS,"Cannot create file",ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+			goto out;
+		}
+
+		/* Delete an empty file. */
+		ts->ts_delete_destination_file = TRUE;
+
+		/* The client may tell us how large the file is (RFC 2349). */
+		if(requested->to_use_tsize)
+		{
+			accepted->to_use_tsize	= TRUE;
+			accepted->to_tsize		= requested->to_tsize;
+
+			ts->ts_transfer_size_known	= TRUE;
+			ts->ts_transfer_size		= requested->to_tsize;
+		}
+	}
+
+	/* We may pick a smaller block and window size than the
+	 * client asked for, but not larger ones.
+	 */
+	if(requested->to_blksize > 0)
+	{
+		accepted->to_blksize = (requested->to_blksize < max_blksize) ? requested->to_blksize : max_blksize;
+
+		ts->ts_blksize = accepted->to_blksize;
+	}
+
+	if(requested->to_windowsize > 0)
+	{
+		accepted->to_windowsize = (requested->to_windowsize < requested_windowsize) ? requested->to_windowsize : requested_windowsize;
+
+		ts->ts_windowsize = accepted->to_windowsize;
+	}
+
+	/* The timeout the client will use is a good starting point
+	 * for ours, too.
+	 */
+	if(requested->to_timeout > 0)
+	{
+		accepted->to_timeout = requested->to_timeout;
+
+		rto_init(&ts->ts_rto,requested->to_timeout * 1000);
+	}
+	else
+	{
+		rto_init(&ts->ts_rto,retransmit_timeout);
+	}
+
+	if(requested->to_use_rollover)
+	{
+		accepted->to_use_rollover	= TRUE;
+		accepted->to_rollover		= requested->to_rollover;
+
+		ts->ts_rollover = accepted->to_rollover;
+	}
+
+	/* If any options are to be used, the client needs to be told
+	 * about them. For a read request, the client will acknowledge
+	 * the options before the first block is sent. For a write
+	 * request, the option acknowledgement takes the place of the
+	 * acknowledgement for block #0.
+	 */
+	if(accepted->to_blksize > 0 || accepted->to_windowsize > 0 || accepted->to_use_tsize ||
+	   accepted->to_timeout > 0 || accepted->to_use_rollover)
+	{
+		ts->ts_options = accepted;
+
+		if(args->Verbose)
+		{
+			Printf("Acknowledging the %s request options (block size %ld bytes, window size %ld).\n",
+				(tftp->th_opcode == TFTP_PACKET_RRQ) ? "read" : "write", ts->ts_blksize, ts->ts_windowsize);
+		}
+
+		D(("Acknowledging the %s request options (block size %ld bytes, window size %ld).",
+			(tftp->th_opcode == TFTP_PACKET_RRQ) ? "read" : "write", ts->ts_blksize, ts->ts_windowsize));
+
+		send_tftp_option_acknowledgement(ts->ts_options,ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+
+		rto_start_timing(&ts->ts_rto);
+
+		if(tftp->th_opcode == TFTP_PACKET_RRQ)
+		{
+			ts->ts_state = tftp_state_option_acknowledgement;
+		}
+		else
+		{
+			preallocate_destination_file(args,ts);
+
+			ts->ts_state = tftp_state_write_to_file;
+		}
+	}
+	else
+	{
+		ts->ts_options = NULL;
+
+		if(tftp->th_opcode == TFTP_PACKET_RRQ)
+		{
+			ts->ts_state = tftp_state_read_from_file;
+
+			ts->ts_send_window = TRUE;
+		}
+		else
+		{
+			if(args->Verbose)
+				Printf("Acknowledging the write request.\n");
+
+			D(("Acknowledging the write request."));
+
+			send_tftp_acknowledgement(0,ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+
+			rto_start_timing(&ts->ts_rto);
+
+			ts->ts_state = tftp_state_write_to_file;
+		}
+	}
+
+	D(("starting the timer"));
+
+	start_session_timer(ts,ts->ts_rto.re_rto);
+
+	result = OK;
+
+ out:
+
+	RETURN(result);
+	return(result);
+}
+
+/****************************************************************************/
+
+/* A client has sent a request to the TFTP port. Unless the request is
+ * already being served, or there are already as many transfers in
+ * progress as permitted, a new session will be started for it. Returns
+ * the new session, or NULL if none was started.
+ */
+static struct tftp_session *
+accept_server_request(BPTR error_output,const struct cmd_args * args,const struct ip * ip,const struct udphdr * udp,const UBYTE * ethernet_address,int num_sessions)
+{
+	const struct tftphdr * tftp = (struct tftphdr *)&udp[1];
+	struct tftp_session * ts = NULL;
+
+	ENTER();
+
+	if(tftp->th_opcode != TFTP_PACKET_RRQ && tftp->th_opcode != TFTP_PACKET_WRQ)
+	{
+		if(args->Verbose)
+			Printf("Ignoring TFTP operation %ld sent to the server port.\n",tftp->th_opcode);
+
+		D(("Ignoring TFTP operation %ld sent to the server port.",tftp->th_opcode));
+
+		goto out;
+	}
+
+	/* The client will repeat its request if we do not respond
+	 * quickly enough.
+	 */
+	if(find_server_session(ip->ip_src,udp->uh_sport) != NULL)
+	{
+		if(args->Verbose)
+			Printf("Ignoring repeated request.\n");
+
+		D(("Ignoring repeated request."));
+
+		goto out;
+	}
+
+	/* The client will try again later. */
+	if(num_sessions >= max_sessions)
+	{
+		if(args->Verbose)
+			Printf("Ignoring request; too many transfers in progress.\n");
+
+		D(("Ignoring request; too many transfers in progress."));
+
+		goto out;
+	}
+
+	ts = AllocVec(sizeof(*ts), MEMF_ANY|MEMF_PUBLIC|MEMF_CLEAR);
+	if(ts == NULL)
+	{
+		D(("Could not allocate TFTP session."));
+
+		goto out;
+	}
+
+	AddTail((struct List *)&session_list,(struct Node *)ts);
+
+	/* A request which cannot be served will be reported
+	 * together with the transfers which have finished.
+	 */
+	if(start_server_session(error_output,args,ts,ip,udp,ethernet_address) != OK)
+		ts->ts_state = tftp_state_finished;
+
+ out:
+
+	RETURN(ts);
+	return(ts);
+}
+
+/****************************************************************************/
+
+/* Pick the size of the buffer used for reading from or writing to a file,
+ * once the block size and the number of blocks in flight are known. The
+ * buffer should hold a couple of windows' worth of data, but no more than
+ * the whole file, and it should not take more than a fair share of the
+ * memory available. Its size is rounded up to a multiple of the file
+ * system's block size, which is what the file system prefers to read and
+ * write in. The BUFFERSIZE parameter overrides all of this. Unless
+ * use_dos_buffer is set, the caller brings its own buffer, and the file
+ * is left unbuffered.
+ */
+static void
+set_file_buffer(const struct cmd_args * args,struct tftp_session * ts,BPTR file,STRPTR name,BOOL use_dos_buffer)
+{
+	struct InfoData * id;
+	LONG file_system_block_size = 512;
+	ULONG buffer_size;
+	ULONG available_memory;
+	BPTR lock;
+
+	ENTER();
+
+	/* The InfoData must be longword-aligned. */
+	id = AllocVec(sizeof(*id), MEMF_ANY|MEMF_PUBLIC);
+	if(id != NULL)
+	{
+		lock = DupLockFromFH(file);
+		if(lock != (BPTR)NULL)
+		{
+			if(Info(lock,id) && id->id_BytesPerBlock > 0)
+				file_system_block_size = id->id_BytesPerBlock;
+
+			UnLock(lock);
+		}
+
+		FreeVec(id);
+	}
+
+	if(args->BufferSize != NULL)
+	{
+		buffer_size = (*args->BufferSize);
+	}
+	else
+	{
+		buffer_size = 4 * ts->ts_blksize * ts->ts_windowsize;
+
+		if(ts->ts_transfer_size_known && buffer_size > ts->ts_transfer_size)
+			buffer_size = ts->ts_transfer_size;
+
+		/* Every transfer in progress may need a buffer, and the
+		 * program needs memory for other purposes, too.
+		 */
+		available_memory = AvailMem(MEMF_FAST|MEMF_LARGEST);
+		if(available_memory == 0)
+			available_memory = AvailMem(MEMF_ANY|MEMF_LARGEST) / 2;
+
+		if(buffer_size > available_memory / (8 * max_sessions))
+			buffer_size = available_memory / (8 * max_sessions);
+
+		if(buffer_size > MAX_AUTO_FILE_BUFFER_SIZE)
+			buffer_size = MAX_AUTO_FILE_BUFFER_SIZE;
+
+		if(buffer_size < DEFAULT_FILE_BUFFER_SIZE)
+			buffer_size = DEFAULT_FILE_BUFFER_SIZE;
+
+		buffer_size = ((buffer_size + file_system_block_size - 1) / file_system_block_size) * file_system_block_size;
+	}
+
+	if(use_dos_buffer)
+		SetVBuf(file,NULL,BUF_FULL,buffer_size);
+
+	ts->ts_file_buffer_size			= buffer_size;
+	ts->ts_file_system_block_size	= file_system_block_size;
+
+	if(args->Verbose)
+		Printf("Using a %lu byte buffer for file \"%s\" (file system block size %ld bytes).\n",buffer_size,name,file_system_block_size);
+
+	D(("Using a %lu byte buffer for file '%s' (file system block size %ld bytes).",buffer_size,name,file_system_block_size));
+
+	LEAVE();
+}
+
+/****************************************************************************/
+
+/* Process the blocks of received data which the disk writer process has
+ * finished writing. If a block could not be written, the transfer it
+ * belongs to is over, and the remote needs to be told.
+ */
+static void
+handle_disk_write_replies(BPTR error_output,const struct cmd_args * args)
+{
+	struct disk_write_message * dwm;
+	struct tftp_session * ts;
+
+	while((dwm = (struct disk_write_message *)GetMsg(disk_write_reply_port)) != NULL)
+	{
+		ts = dwm->dwm_UserData;
+
+		ts->ts_num_pending_writes--;
+
+		/* That half of the staging buffer may be filled again. */
+		ts->ts_staging_pending[(dwm->dwm_Data == ts->ts_staging_buffer) ? 0 : 1] = FALSE;
+
+		/* Only the first error counts. */
+		if(dwm->dwm_Error != 0 && (ts->ts_state != tftp_state_finished || ts->ts_result == RETURN_OK))
+		{
+			TEXT error_message[256];
+
+			Fault(dwm->dwm_Error,NULL,error_message,sizeof(error_message));
+
+			if(!args->Quiet)
+				FPrintf(error_output, "%s: Error writing to file \"%s\" (%s).\n","TFTPClient",ts->ts_to_path,error_message);
+
+			D(("Error writing to file '%s' (%s).",ts->ts_to_path,error_message));
+
+			select_session(ts);
+
+			send_tftp_error(TFTP_ERROR_UNDEF,"Error writing to file",ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+
+			ts->ts_result = RETURN_ERROR;
+			ts->ts_state = tftp_state_finished;
+		}
+
+		release_disk_write_message(dwm);
+	}
+}
+
+/****************************************************************************/
+
+/* Hand the data collected in the staging buffer over to the disk writer
+ * process, which writes it with a single Write() call, and begin filling
+ * the other half of the buffer. If the disk write queue is full, we have
+ * to wait for the disk writer process to catch up.
+ */
+static void
+flush_session_staging(BPTR error_output,const struct cmd_args * args,struct tftp_session * ts)
+{
+	struct disk_write_message * dwm;
+
+	if(ts->ts_staging_used == 0)
+		return;
+
+	while((dwm = obtain_disk_write_message()) == NULL)
+	{
+		D(("Disk write queue is full; waiting for the disk writer process to catch up."));
+
+		WaitPort(disk_write_reply_port);
+
+		handle_disk_write_replies(error_output,args);
+	}
+
+	dwm->dwm_File		= ts->ts_destination_file;
+	dwm->dwm_Data		= &ts->ts_staging_buffer[ts->ts_staging_half * ts->ts_staging_size];
+	dwm->dwm_Length		= ts->ts_staging_used;
+	dwm->dwm_UserData	= ts;
+
+	queue_disk_write(dwm);
+
+	ts->ts_num_pending_writes++;
+	ts->ts_num_staging_writes++;
+
+	ts->ts_staging_pending[ts->ts_staging_half] = TRUE;
+
+	ts->ts_staging_half ^= 1;
+	ts->ts_staging_used = 0;
+}
+
+/****************************************************************************/
+
+/* Store a block of received data in the staging buffer, so that it can be
+ * acknowledged right away. Only blocks which arrived in order and which
+ * have been checked end up here; frames which turn out to be of no use
+ * never touch the staging buffer. Once half of the buffer is full, it is
+ * handed over to the disk writer process, and if the other half is still
+ * being written, the acknowledgement has to wait. Returns OK if the block
+ * has been stored, and FAILURE if the transfer is over because the data
+ * could not be written.
+ */
+static int
+write_session_block(BPTR error_output,const struct cmd_args * args,struct tftp_session * ts,const UBYTE * data,int length)
+{
+	int result = FAILURE;
+
+	if(ts->ts_file_buffer_size == 0)
+	{
+		set_file_buffer(args,ts,ts->ts_destination_file,ts->ts_to_path,FALSE);
+
+		/* Each half of the staging buffer must have room for at
+		 * least one block.
+		 */
+		ts->ts_staging_size = ts->ts_file_buffer_size;
+		if(ts->ts_staging_size < ts->ts_blksize)
+			ts->ts_staging_size = ts->ts_blksize;
+
+		ts->ts_staging_buffer = AllocVec(2 * ts->ts_staging_size, MEMF_ANY|MEMF_PUBLIC);
+		if(ts->ts_staging_buffer == NULL)
+		{
+			if(!args->Quiet)
+				PrintFault(ERROR_NO_FREE_STORE,"TFTPClient");
+
+			D(("Could not allocate %lu byte staging buffer.",2 * ts->ts_staging_size));
+
+			send_tftp_error(TFTP_ERROR_UNDEF,"Not enough memory",ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+
+			ts->ts_result = RETURN_FAIL;
+			ts->ts_state = tftp_state_finished;
+
+			goto out;
+		}
+	}
+
+	if(ts->ts_staging_used + length > ts->ts_staging_size)
+		flush_session_staging(error_output,args,ts);
+
+	if(ts->ts_staging_pending[ts->ts_staging_half])
+	{
+		D(("Staging buffer is full; waiting for the disk writer process to catch up."));
+
+		do
+		{
+			WaitPort(disk_write_reply_port);
+
+			handle_disk_write_replies(error_output,args);
+		}
+		while(ts->ts_staging_pending[ts->ts_staging_half]);
+	}
+
+	/* The replies to the disk writer messages may have
+	 * been for a different transfer.
+	 */
+	select_session(ts);
+
+	/* Writing the data may have failed in the meantime. */
+	if(ts->ts_state == tftp_state_finished)
+		goto out;
+
+	memmove(&ts->ts_staging_buffer[ts->ts_staging_half * ts->ts_staging_size + ts->ts_staging_used],data,length);
+
+	ts->ts_staging_used += length;
+
+	result = OK;
+
+ out:
+
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Before the destination file of a transfer can be closed, all the data
+ * which the disk writer process has yet to write must have been written.
+ */
+static void
+wait_for_session_writes(BPTR error_output,const struct cmd_args * args,struct tftp_session * ts)
+{
+	flush_session_staging(error_output,args,ts);
+
+	while(ts->ts_num_pending_writes > 0)
+	{
+		WaitPort(disk_write_reply_port);
+
+		handle_disk_write_replies(error_output,args);
+	}
+}
+
+/****************************************************************************/
+
+/* The server has agreed to send the file to a multicast group (RFC 2090),
+ * which we need to join. Since the blocks may arrive in any order, and
+ * some of them may be missed, we keep track of which ones have arrived.
+ * Returns OK if the blocks can be received, and FAILURE otherwise.
+ */
+static int
+start_multicast_reception(BPTR error_output,const struct cmd_args * args,struct tftp_session * ts,const struct tftp_options * accepted)
+{
+	int result = FAILURE;
+
+	ENTER();
+
+	/* The first option acknowledgement must name the group. */
+	if(accepted->to_multicast_address == 0 || accepted->to_multicast_port == 0)
+	{
+		if(!args->Quiet)
+			FPrintf(error_output, "%s: Server did not name the multicast group to use -- aborting.\n","TFTPClient");
+
+		D(("Server did not name the multicast group to use -- aborting."));
+
+		send_tftp_error(TFTP_ERROR_OPTION,"Multicast group missing",ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+		goto out;
+	}
+
+	/* Block numbers do not start over, which limits the file to 65535 blocks. */
+	ts->ts_block_map = AllocVec((MAX_WIRE_BLOCK_NUMBER + 1) / 8, MEMF_ANY|MEMF_PUBLIC|MEMF_CLEAR);
+	if(ts->ts_block_map == NULL)
+	{
+		if(!args->Quiet)
+			PrintFault(ERROR_NO_FREE_STORE,"TFTPClient");
+
+		D(("Could not allocate block map."));
+
+		send_tftp_error(TFTP_ERROR_UNDEF,"Not enough memory",ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+		goto out;
+	}
+
+	ts->ts_multicast_ipv4_address		= accepted->to_multicast_address;
+	ts->ts_multicast_udp_port_number	= accepted->to_multicast_port;
+	ts->ts_master_client				= accepted->to_master_client;
+
+	if(join_multicast_group(ts->ts_multicast_ipv4_address) != OK)
+	{
+		if(!args->Quiet)
+		{
+			FPrintf(error_output, "%s: Could not join multicast group %lu.%lu.%lu.%lu -- aborting.\n","TFTPClient",
+				(ts->ts_multicast_ipv4_address >> 24) & 0xff,
+				(ts->ts_multicast_ipv4_address >> 16) & 0xff,
+				(ts->ts_multicast_ipv4_address >>  8) & 0xff,
+				 ts->ts_multicast_ipv4_address        & 0xff);
+		}
+
+		D(("Could not join multicast group 0x%08lx -- aborting.",ts->ts_multicast_ipv4_address));
+
+		send_tftp_error(TFTP_ERROR_UNDEF,"Cannot join multicast group",ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+		goto out;
+	}
+
+	ts->ts_multicast = TRUE;
+
+	/* The file may already have its final size. */
+	if(ts->ts_destination_file_preallocated)
+		ts->ts_file_size = ts->ts_transfer_size;
+
+	if(args->Verbose)
+	{
+		Printf("Receiving the file through multicast group %lu.%lu.%lu.%lu, UDP port %ld (%s).\n",
+			(ts->ts_multicast_ipv4_address >> 24) & 0xff,
+			(ts->ts_multicast_ipv4_address >> 16) & 0xff,
+			(ts->ts_multicast_ipv4_address >>  8) & 0xff,
+			 ts->ts_multicast_ipv4_address        & 0xff,
+			ts->ts_multicast_udp_port_number,
+			ts->ts_master_client ? "master client" : "passive client");
+	}
+
+	D(("Receiving the file through multicast group 0x%08lx, UDP port %ld (%s).",
+		ts->ts_multicast_ipv4_address,ts->ts_multicast_udp_port_number,
+		ts->ts_master_client ? "master client" : "passive client"));
+
+	result = OK;
+
+ out:
+
+	RETURN(result);
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Store a data block which was sent to the multicast group, or to this
+ * client alone. Each block is written to its place in the file, and the
+ * next block number we wait for is the first one which is still missing.
+ * The master client acknowledges the block which precedes it, which tells
+ * the server which block to send next. Once all the blocks have arrived,
+ * the server is told so, and the transfer is complete.
+ */
+static void
+receive_multicast_block(BPTR error_output,const struct cmd_args * args,struct tftp_session * ts,const struct tftphdr * tftp,int payload_length)
+{
+	int block = tftp->th_block;
+	ULONG position;
+
+	ENTER();
+
+	if(block == 0 || (ts->ts_multicast_final_block != 0 && block > ts->ts_multicast_final_block) ||
+	   (ts->ts_block_map[block / 8] & (1 << (block % 8))) != 0)
+	{
+		if(args->Verbose)
+			Printf("Ignoring receipt of block #%ld.\n",block);
+
+		D(("Ignoring receipt of block #%ld.",block));
+	}
+	else
+	{
+		if(args->Verbose)
+			Printf("Writing block #%ld (%ld bytes).\n",block,payload_length);
+
+		D(("Writing block #%ld (%ld bytes).",block,payload_length));
+
+		position = (ULONG)(block - 1) * ts->ts_blksize;
+
+		if(ts->ts_file_buffer_size == 0)
+			set_file_buffer(args,ts,ts->ts_destination_file,ts->ts_to_path,TRUE);
+
+		SetIoErr(0);
+
+		/* The file system will not seek past the end of the file,
+		 * which is why the file may have to grow first.
+		 */
+		if(position > ts->ts_file_size)
+		{
+			if(Flush(ts->ts_destination_file) == DOSFALSE ||
+			   SetFileSize(ts->ts_destination_file,position,OFFSET_BEGINNING) == -1)
+			{
+				goto write_error;
+			}
+
+			ts->ts_file_size = position;
+		}
+
+		if(Seek(ts->ts_destination_file,position,OFFSET_BEGINNING) == -1)
+			goto write_error;
+
+		if(payload_length > 0)
+		{
+			if(FWrite(ts->ts_destination_file,(APTR)tftp->th_data,payload_length,1) == 0)
+				goto write_error;
+
+			add_to_quad(&ts->ts_num_bytes_transferred,payload_length);
+
+			/* We received some data to keep, so do not delete the file. */
+			ts->ts_delete_destination_file = FALSE;
+		}
+
+		if(ts->ts_file_size < position + payload_length)
+			ts->ts_file_size = position + payload_length;
+
+		ts->ts_block_map[block / 8] |= (1 << (block % 8));
+
+		/* Is this the last block of the file? */
+		if(payload_length < ts->ts_blksize)
+			ts->ts_multicast_final_block = block;
+
+		while(ts->ts_block_number <= MAX_WIRE_BLOCK_NUMBER && (ts->ts_block_map[ts->ts_block_number / 8] & (1 << (ts->ts_block_number % 8))) != 0)
+			ts->ts_block_number++;
+
+		rto_stop_timing(&ts->ts_rto);
+	}
+
+	/* Has the whole file arrived? Then the file has to be cut
+	 * down to size, in case it was preallocated, and the server
+	 * needs to know that this client is done.
+	 */
+	if(ts->ts_multicast_final_block != 0 && ts->ts_block_number > ts->ts_multicast_final_block)
+	{
+		SetIoErr(0);
+
+		if(Flush(ts->ts_destination_file) == DOSFALSE ||
+		   SetFileSize(ts->ts_destination_file,ts->ts_file_size,OFFSET_BEGINNING) == -1)
+		{
+			goto write_error;
+		}
+
+		if(args->Verbose)
+			Printf("Acknowledging receipt of block #%ld.\n",ts->ts_multicast_final_block);
+
+		D(("Acknowledging receipt of block #%ld.",ts->ts_multicast_final_block));
+
+		send_tftp_acknowledgement(ts->ts_multicast_final_block,ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+
+		if(args->Verbose)
+			Printf("Transmission completed.\n");
+
+		D(("Transmission completed."));
+
+		ts->ts_result = RETURN_OK;
+		ts->ts_state = tftp_state_finished;
+		goto out;
+	}
+
+	if(ts->ts_master_client)
+	{
+		if(args->Verbose)
+			Printf("Acknowledging receipt of block #%ld.\n",ts->ts_block_number-1);
+
+		D(("Acknowledging receipt of block #%ld.",ts->ts_block_number-1));
+
+		send_tftp_acknowledgement(ts->ts_block_number-1,ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+
+		rto_start_timing(&ts->ts_rto);
+	}
+
+	D(("starting the timer"));
+
+	start_session_timer(ts,ts->ts_rto.re_rto);
+
+	goto out;
+
+ write_error:
+
+	{
+		TEXT error_message[256];
+
+		Fault(IoErr(),NULL,error_message,sizeof(error_message));
+
+		if(!args->Quiet)
+			FPrintf(error_output, "%s: Error writing to file \"%s\" (%s).\n","TFTPClient",ts->ts_to_path,error_message);
+
+		D(("Error writing to file '%s' (%s).",ts->ts_to_path,error_message));
+
+		send_tftp_error(TFTP_ERROR_UNDEF,"Error writing to file",ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+
+		ts->ts_result = RETURN_ERROR;
+		ts->ts_state = tftp_state_finished;
+	}
+
+ out:
+
+	LEAVE();
+}
+
+/****************************************************************************/
+
+/* Process a TFTP packet which the server (or the client, if we are
+ * serving files) sent to this session.
+ */
+static void
+handle_session_datagram(BPTR error_output,const struct cmd_args * args,struct tftp_session * ts,const struct udphdr * udp)
+{
+	const struct tftphdr * tftp = (struct tftphdr *)&udp[1];
+	int length = udp->uh_ulen - sizeof(*udp);
+
+	ENTER();
+
+	select_session(ts);
+
+	/* The peer is still there. */
+	ts->ts_num_retransmissions = 0;
+
+	/* Did the server reject the options which we sent along with
+	 * the read/write request? Then we try again without any options.
+	 */
+	if (tftp->th_opcode == TFTP_PACKET_ERROR && tftp->th_code == TFTP_ERROR_OPTION && ts->ts_options != NULL && NOT ts->ts_server &&
+	    (ts->ts_state == tftp_state_request_read || ts->ts_state == tftp_state_request_write))
+	{
+		SHOWMSG("TFTP opcode = TFTP_PACKET_ERROR (option negotiation failed)");
+
+		if(args->Verbose)
+			Printf("Server rejected the transfer options; trying again without them.\n");
+
+		D(("Server rejected the transfer options; trying again without them."));
+
+		ts->ts_options = NULL;
+
+		rto_stop_timing(&ts->ts_rto);
+
+		start_tftp(ts->ts_state == tftp_state_request_write ? TFTP_PACKET_WRQ : TFTP_PACKET_RRQ,
+			ts->ts_remote_filename,ts->ts_options,ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+
+		rto_start_timing(&ts->ts_rto);
+
+		D(("starting the timer"));
+
+		start_session_timer(ts,ts->ts_rto.re_rto);
+	}
+	/* Server responded with an error? We print the error message and abort. */
+	else if (tftp->th_opcode == TFTP_PACKET_ERROR)
+	{
+		const char * error_text;
+		char number[20];
+		char message_buffer[SEGSIZE+1];
+		int message_length;
+
+		SHOWMSG("TFTP opcode = TFTP_PACKET_ERROR");
+
+		error_text = get_tftp_error_text(tftp->th_code);
+		if(error_text == NULL)
+		{
+			sprintf(number,"error %d",tftp->th_code);
+			error_text = number;
+		}
+
+		message_length = length - offsetof(struct tftphdr, th_msg);
+		if(message_length < 0)
+			message_length = 0;
+		else if (message_length >= (int)sizeof(message_buffer))
+			message_length = sizeof(message_buffer)-1;
+
+		memmove(message_buffer,tftp->th_msg,message_length);
+		message_buffer[message_length] = '\0';
+
+		if(!args->Quiet)
+			FPrintf(error_output, "%s: %s responded with error '%s', \"%s\".\n","TFTPClient",ts->ts_server ? "Client" : "Server",error_text,message_buffer);
+
+		D(("%s responded with error '%s', '%s'.",ts->ts_server ? "Client" : "Server",error_text,message_buffer));
+
+		ts->ts_result = RETURN_ERROR;
+		ts->ts_state = tftp_state_finished;
+		goto out;
+	}
+	/* Server has transmitted data? */
+	else if (tftp->th_opcode == TFTP_PACKET_DATA)
+	{
+		int payload_length = length - offsetof(struct tftphdr, th_data);
+
+		SHOWMSG("TFTP opcode = TFTP_PACKET_DATA");
+
+		/* Make sure that the data packet size is sane. */
+		if(payload_length > ts->ts_blksize)
+		{
+			if(args->Verbose)
+			{
+				Printf("Data packet size (%ld bytes) is larger than expected; keeping only the first %ld bytes.\n",
+					payload_length, ts->ts_blksize);
+			}
+			
+			D(("Data packet size (%ld bytes) is larger than expected; keeping only the first %ld bytes.",payload_length, ts->ts_blksize));
+
+			payload_length = ts->ts_blksize;
+		}
+
+		/* Did we just request to start reception of data? If the
+		 * server ignored the options we asked for, it will begin
+		 * by sending the first data block, using the default
+		 * block size.
+		 */
+		if (ts->ts_state == tftp_state_request_read)
+		{
+			/* This should be the very first data block. */
+			if(tftp->th_block == 1)
+			{
+				/* This is important: the server's tftp session is bound
+				 * to a specific port number now.
+				 */
+				ts->ts_server_udp_port_number = udp->uh_sport;
+				ts->ts_server_udp_port_number_known = TRUE;
+
+				if(args->Verbose)
+					Printf("Server has acknowledged the read request (using UDP port number %ld).\n", ts->ts_server_udp_port_number);
+
+				D(("Server has acknowledged the read request (using UDP port number %ld).", ts->ts_server_udp_port_number));
+
+				rto_stop_timing(&ts->ts_rto);
+
+				/* Store the data, if any. */
+				if(payload_length > 0)
+				{
+					if(args->Verbose)
+						Printf("Writing block #%ld (%ld bytes).\n",tftp->th_block,payload_length);
+
+					D(("Writing block #%ld (%ld bytes).",tftp->th_block,payload_length));
+
+					if(write_session_block(error_output,args,ts,tftp->th_data,payload_length) != OK)
+						goto out;
+
+					add_to_quad(&ts->ts_num_bytes_transferred,payload_length);
+
+					/* We received some data to keep, so do not delete the file. */
+					ts->ts_delete_destination_file = FALSE;
+				}
+				else
+				{
+					SHOWMSG("no data in the packet");
+				}
+
+				/* Is this the last data to be received? */
+				if(payload_length < ts->ts_blksize)
+				{
+					SHOWMSG("this is the last block transmitted by the server");
+
+					ts->ts_last_block_transmitted = TRUE;
+					ts->ts_num_eof_acknowledgements--;
+				}
+
+				ts->ts_state = tftp_state_write_to_file;
+
+				ts->ts_block_number = 2;
+
+				if(args->Verbose)
+					Printf("Acknowledging receipt of block #%ld.\n",ts->ts_block_number-1);
+
+				D(("Acknowledging receipt of block #%ld.",ts->ts_block_number-1));
+
+				send_tftp_acknowledgement(get_wire_block_number(ts->ts_block_number-1,ts->ts_rollover),ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+
+				rto_start_timing(&ts->ts_rto);
+
+				D(("starting the timer"));
+
+				start_session_timer(ts,ts->ts_rto.re_rto);
+			}
+			else
+			{
+				if(args->Verbose)
+					Printf("Ignoring receipt of block #%ld.\n",tftp->th_block);
+				
+				D(("Ignoring receipt of block #%ld.",tftp->th_block));
+			}
+		}
+		/* Are the blocks sent to a multicast group? */
+		else if (ts->ts_state == tftp_state_write_to_file && ts->ts_multicast)
+		{
+			receive_multicast_block(error_output,args,ts,tftp,payload_length);
+		}
+		/* Are we already receiving data to be written? */
+		else if (ts->ts_state == tftp_state_write_to_file)
+		{
+			/* Is this the next block we expected? */
+			if(tftp->th_block == get_wire_block_number(ts->ts_block_number,ts->ts_rollover))
+			{
+				/* Store the data, if any. */
+				if(payload_length > 0)
+				{
+					if(args->Verbose)
+						Printf("Writing block #%ld (%ld bytes).\n",ts->ts_block_number,payload_length);
+
+					D(("Writing block #%ld (%ld bytes).",ts->ts_block_number,payload_length));
+
+					if(write_session_block(error_output,args,ts,tftp->th_data,payload_length) != OK)
+						goto out;
+
+					add_to_quad(&ts->ts_num_bytes_transferred,payload_length);
+
+					/* We received some data to keep, do not delete the file. */
+					ts->ts_delete_destination_file = FALSE;
+				}
+
+				/* Is this the last data to be received? */
+				if(payload_length < ts->ts_blksize)
+				{
+					ts->ts_last_block_transmitted = TRUE;
+					ts->ts_num_eof_acknowledgements--;
+				}
+
+				ts->ts_block_number++;
+
+				ts->ts_gap_acknowledged = FALSE;
+
+				/* This measures the time from sending the last
+				 * acknowledgement to receiving the block which
+				 * follows it.
+				 */
+				rto_stop_timing(&ts->ts_rto);
+
+				/* The server expects only one acknowledgement
+				 * per window (RFC 7440), and for the last block.
+				 */
+				ts->ts_blocks_since_acknowledgement++;
+
+				if(ts->ts_blocks_since_acknowledgement >= ts->ts_windowsize || ts->ts_last_block_transmitted)
+				{
+					if(args->Verbose)
+						Printf("Acknowledging receipt of block #%ld.\n",ts->ts_block_number-1);
+					
+					D(("Acknowledging receipt of block #%ld.",ts->ts_block_number-1));
+
+					send_tftp_acknowledgement(get_wire_block_number(ts->ts_block_number-1,ts->ts_rollover),ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+
+					rto_start_timing(&ts->ts_rto);
+
+					ts->ts_blocks_since_acknowledgement = 0;
+				}
+
+				/* If we know how large the file is supposed to be and
+				 * all of it has arrived, there is no need to wait and
+				 * see if the server sends the last block again.
+				 */
+				if(ts->ts_last_block_transmitted && ts->ts_transfer_size_known && quad_equals(&ts->ts_num_bytes_transferred,ts->ts_transfer_size))
+				{
+					if(args->Verbose)
+						Printf("Transmission completed.\n");
+
+					D(("Transmission completed."));
+
+					ts->ts_result = RETURN_OK;
+					ts->ts_state = tftp_state_finished;
+					goto out;
+				}
+
+				D(("starting the timer"));
+
+				start_session_timer(ts,ts->ts_rto.re_rto);
+			}
+			/* No, this is the wrong block. */
+			else
+			{
+				if(args->Verbose)
+					Printf("Ignoring receipt of block #%ld; was expecting block #%ld instead.\n",tftp->th_block,ts->ts_block_number);
+				
+				D(("Ignoring receipt of block #%ld; was expecting block #%ld instead.",tftp->th_block,ts->ts_block_number));
+
+				/* A block of the current window went missing. Tell
+				 * the server right away where to pick up again, but
+				 * only once, since the remainder of the window is
+				 * likely to arrive out of order, too.
+				 */
+				if(ts->ts_windowsize > 1 && NOT ts->ts_gap_acknowledged && NOT ts->ts_last_block_transmitted)
+				{
+					if(args->Verbose)
+						Printf("Acknowledging receipt of block #%ld.\n",ts->ts_block_number-1);
+
+					D(("Acknowledging receipt of block #%ld.",ts->ts_block_number-1));
+
+					send_tftp_acknowledgement(get_wire_block_number(ts->ts_block_number-1,ts->ts_rollover),ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+
+					rto_start_timing(&ts->ts_rto);
+
+					ts->ts_blocks_since_acknowledgement = 0;
+					ts->ts_gap_acknowledged = TRUE;
+				}
+			}
+		}
+		else
+		{
+			if(args->Verbose)
+				Printf("Ignoring receipt of unexpected data block #%ld.\n",tftp->th_block);
+			
+			D(("Ignoring receipt of unexpected data block #%ld.",tftp->th_block));
+		}
+	}
+	/* Server has acknowledged the options which we sent along
+	 * with the read or write request?
+	 */
+	else if (tftp->th_opcode == TFTP_PACKET_OACK)
+	{
+		SHOWMSG("TFTP opcode = TFTP_PACKET_OACK");
+
+		if ((ts->ts_state == tftp_state_request_read || ts->ts_state == tftp_state_request_write) && ts->ts_options != NULL)
+		{
+			/* If the server picked options or option values which we
+			 * did not ask for, we have to give up.
+			 */
+			if(parse_tftp_option_acknowledgement(tftp,length,ts->ts_options,&ts->ts_accepted_options) != OK)
+			{
+				if(!args->Quiet)
+					FPrintf(error_output, "%s: Server acknowledged unsupported transfer options -- aborting.\n","TFTPClient");
+
+				D(("Server acknowledged unsupported transfer options -- aborting."));
+
+				send_tftp_error(TFTP_ERROR_OPTION,"Unsupported transfer options",ts->ts_client_udp_port_number,udp->uh_sport);
+
+				ts->ts_result = RETURN_ERROR;
+				ts->ts_state = tftp_state_finished;
+				goto out;
+			}
+
+			rto_stop_timing(&ts->ts_rto);
+
+			/* This is important: the server's tftp session is bound
+			 * to a specific port number now.
+			 */
+			ts->ts_server_udp_port_number = udp->uh_sport;
+			ts->ts_server_udp_port_number_known = TRUE;
+
+			if(ts->ts_accepted_options.to_blksize > 0)
+				ts->ts_blksize = ts->ts_accepted_options.to_blksize;
+
+			if(ts->ts_accepted_options.to_windowsize > 0)
+				ts->ts_windowsize = ts->ts_accepted_options.to_windowsize;
+
+			if(ts->ts_accepted_options.to_use_rollover)
+				ts->ts_rollover = ts->ts_accepted_options.to_rollover;
+
+			if(ts->ts_accepted_options.to_use_tsize)
+			{
+				ts->ts_transfer_size_known = TRUE;
+				ts->ts_transfer_size = ts->ts_accepted_options.to_tsize;
+			}
+
+			if(args->Verbose)
+			{
+				Printf("Server has acknowledged the %s request options (using UDP port number %ld, block size %ld bytes, window size %ld).\n",
+					(ts->ts_state == tftp_state_request_read) ? "read" : "write", ts->ts_server_udp_port_number, ts->ts_blksize, ts->ts_windowsize);
+			}
+
+			D(("Server has acknowledged the %s request options (using UDP port number %ld, block size %ld bytes, window size %ld).",
+				(ts->ts_state == tftp_state_request_read) ? "read" : "write", ts->ts_server_udp_port_number, ts->ts_blksize, ts->ts_windowsize));
+
+			/* For a read request we need to acknowledge the options
+			 * by acknowledging block #0, and then the server will
+			 * respond by sending the first data block.
+			 */
+			if (ts->ts_state == tftp_state_request_read)
+			{
+				preallocate_destination_file(args,ts);
+
+				if(ts->ts_accepted_options.to_use_multicast && start_multicast_reception(error_output,args,ts,&ts->ts_accepted_options) != OK)
+				{
+					ts->ts_result = RETURN_ERROR;
+					ts->ts_state = tftp_state_finished;
+					goto out;
+				}
+
+				ts->ts_state = tftp_state_write_to_file;
+
+				ts->ts_block_number = 1;
+
+				/* When receiving through a multicast group, only
+				 * the master client asks for the data blocks.
+				 */
+				if(NOT ts->ts_multicast || ts->ts_master_client)
+				{
+					if(args->Verbose)
+						Printf("Acknowledging receipt of the options.\n");
+
+					D(("Acknowledging receipt of the options."));
+
+					send_tftp_acknowledgement(0,ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+
+					rto_start_timing(&ts->ts_rto);
+				}
+
+				D(("starting the timer"));
+
+				start_session_timer(ts,ts->ts_rto.re_rto);
+			}
+			/* For a write request the option acknowledgement takes
+			 * the place of the acknowledgement for block #0.
+			 */
+			else
+			{
+				ts->ts_state = tftp_state_read_from_file;
+
+				ts->ts_send_window = TRUE;
+			}
+		}
+		/* The server may pick a different master client for the
+		 * multicast group while the transfer is in progress.
+		 */
+		else if (ts->ts_state == tftp_state_write_to_file && ts->ts_multicast)
+		{
+			struct tftp_options accepted;
+
+			if(parse_tftp_option_acknowledgement(tftp,length,ts->ts_options,&accepted) == OK && accepted.to_use_multicast &&
+			   (accepted.to_multicast_address == 0 || accepted.to_multicast_address == ts->ts_multicast_ipv4_address))
+			{
+				ts->ts_master_client = accepted.to_master_client;
+
+				if(args->Verbose)
+					Printf("Server has made this computer the %s client.\n",ts->ts_master_client ? "master" : "passive");
+
+				D(("Server has made this computer the %s client.",ts->ts_master_client ? "master" : "passive"));
+
+				/* The master client picks up where the blocks
+				 * received so far leave off.
+				 */
+				if(ts->ts_master_client)
+				{
+					if(args->Verbose)
+						Printf("Acknowledging receipt of block #%ld.\n",ts->ts_block_number-1);
+
+					D(("Acknowledging receipt of block #%ld.",ts->ts_block_number-1));
+
+					send_tftp_acknowledgement(ts->ts_block_number-1,ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+
+					rto_start_timing(&ts->ts_rto);
+
+					D(("starting the timer"));
+
+					start_session_timer(ts,ts->ts_rto.re_rto);
+				}
+			}
+			else
+			{
+				if(args->Verbose)
+					Printf("Ignoring receipt of option acknowledgement.\n");
+
+				D(("Ignoring receipt of option acknowledgement."));
+			}
+		}
+		else
+		{
+			if(args->Verbose)
+				Printf("Ignoring receipt of option acknowledgement.\n");
+
+			D(("Ignoring receipt of option acknowledgement."));
+		}
+	}
+	/* Server has acknowledged reception of data, or of the write request? */
+	else if (tftp->th_opcode == TFTP_PACKET_ACK)
+	{
+		SHOWMSG("TFTP opcode = TFTP_PACKET_ACK");
+
+		/* Could this be the server response to the write request? */
+		if (ts->ts_state == tftp_state_request_write)
+		{
+			/* The acknowledgement comes in the form of block #0 only. */
+			if(tftp->th_block == 0)
+			{
+				/* This is important: the server's tftp session is bound
+				 * to a specific port number now.
+				 */
+				ts->ts_server_udp_port_number = udp->uh_sport;
+				ts->ts_server_udp_port_number_known = TRUE;
+
+				if(args->Verbose)
+					Printf("Server has acknowledged the write request (using UDP port number %ld).\n", ts->ts_server_udp_port_number);
+				
+				D(("Server has acknowledged the write request (using UDP port number %ld).", ts->ts_server_udp_port_number));
+
+				rto_stop_timing(&ts->ts_rto);
+
+				ts->ts_state = tftp_state_read_from_file;
+
+				ts->ts_send_window = TRUE;
+			}
+			else
+			{
+				if(args->Verbose)
+					Printf("Ignoring receipt of acknowledgement for block #%ld.\n",tftp->th_block);
+				
+				D(("Ignoring receipt of acknowledgement for block #%ld.",tftp->th_block));
+			}
+		}
+		/* Has the client acknowledged the options which we sent in
+		 * response to its read request?
+		 */
+		else if (ts->ts_state == tftp_state_option_acknowledgement)
+		{
+			if(tftp->th_block == 0)
+			{
+				if(args->Verbose)
+					Printf("Client has acknowledged the options.\n");
+
+				D(("Client has acknowledged the options."));
+
+				rto_stop_timing(&ts->ts_rto);
+
+				ts->ts_state = tftp_state_read_from_file;
+
+				ts->ts_send_window = TRUE;
+			}
+			else
+			{
+				if(args->Verbose)
+					Printf("Ignoring receipt of acknowledgement for block #%ld.\n",tftp->th_block);
+
+				D(("Ignoring receipt of acknowledgement for block #%ld.",tftp->th_block));
+			}
+		}
+		/* Could this be the response to the blocks we just sent to the server? */
+		else if (ts->ts_state == tftp_state_read_from_file)
+		{
+			/* The acknowledgement covers all the blocks up to and including
+			 * the one it names. Only the lower 16 bits of the block number
+			 * are transmitted, which is why we need to figure out which
+			 * block of the current window is meant.
+			 */
+			int acknowledged_block = get_block_number_from_wire(tftp->th_block,ts->ts_first_unacknowledged_block,ts->ts_rollover);
+			int slot;
+
+			/* Is this the acknowledgement for one of the blocks just sent? */
+			if(ts->ts_first_unacknowledged_block <= acknowledged_block && acknowledged_block < ts->ts_next_block_to_send)
+			{
+				/* Are we finished now? */
+				if(acknowledged_block == ts->ts_final_block)
+				{
+					if(args->Verbose)
+						Printf("Transmission completed.\n");
+					
+					D(("Transmission completed."));
+
+					ts->ts_result = RETURN_OK;
+					ts->ts_state = tftp_state_finished;
+					goto out;
+				}
+
+				if(args->Verbose)
+					Printf("Server has acknowledged receipt of block #%ld.\n", acknowledged_block);
+
+				D(("Server has acknowledged receipt of block #%ld.", acknowledged_block));
+
+				/* Measure how long it took for the acknowledgement to
+				 * arrive, unless the block had to be sent more than once.
+				 */
+				slot = (acknowledged_block - 1) % get_num_window_slots(ts);
+
+				if(NOT ts->ts_window_slot_resent[slot])
+					rto_sample(&ts->ts_rto,get_milliseconds() - ts->ts_window_slot_time[slot]);
+
+				/* If the server did not receive all the blocks of the
+				 * window, pick up again after the last one it did receive.
+				 */
+				ts->ts_first_unacknowledged_block = ts->ts_next_block_to_send = acknowledged_block + 1;
+
+				ts->ts_send_window = TRUE;
+			}
+			/* The server has not received the first block of
+			 * the window, so it has to be sent again.
+			 */
+			else if (ts->ts_windowsize > 1 && acknowledged_block == ts->ts_first_unacknowledged_block - 1 && ts->ts_next_block_to_send > ts->ts_first_unacknowledged_block)
+			{
+				if(args->Verbose)
+					Printf("Server has not received block #%ld.\n", ts->ts_first_unacknowledged_block);
+
+				D(("Server has not received block #%ld.", ts->ts_first_unacknowledged_block));
+
+				ts->ts_next_block_to_send = ts->ts_first_unacknowledged_block;
+
+				ts->ts_send_window = TRUE;
+			}
+			else
+			{
+				if(args->Verbose)
+					Printf("Ignoring receipt of acknowledgement for block #%ld; was expecting block #%ld instead.\n",tftp->th_block,ts->ts_next_block_to_send-1);
+				
+				D(("Ignoring receipt of acknowledgement for block #%ld; was expecting block #%ld instead.",tftp->th_block,ts->ts_next_block_to_send-1));
+			}
+		}
+		else
+		{
+			if(args->Verbose)
+				Printf("Ignoring receipt of acknowledgement for block #%ld.\n",tftp->th_block);
+			
+			D(("Ignoring receipt of acknowledgement for block #%ld.",tftp->th_block));
+		}
+	}
+	/* This is an unsupported TFTP operation. We report the problem and then quit. */
+	else
+	{
+		if(!args->Quiet)
+			FPrintf(error_output, "%s: Received unsupported TFTP operation %ld -- aborting.\n","TFTPClient",tftp->th_opcode);
+		
+		D(("Received unsupported TFTP operation %ld -- aborting.",tftp->th_opcode));
+
+		send_tftp_error(TFTP_ERROR_BADOP,"Huh?",ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+
+		ts->ts_result = RETURN_ERROR;
+		ts->ts_state = tftp_state_finished;
+		goto out;
+	}
+
+ out:
+
+	LEAVE();
+}
+
+/****************************************************************************/
+
+/* The server could not be reached, or it no longer responds
+ * to the session's UDP port, which ends the transfer.
+ */
+static void
+handle_session_unreachable(BPTR error_output,const struct cmd_args * args,struct tftp_session * ts,int code)
+{
+	const char * type;
+	char number[20];
+
+	ENTER();
+
+	switch(code)
+	{
+		case icmp_code_unreach_net:
+
+			type = "bad network";
+			break;
+
+		case icmp_code_unreach_host:
+
+			type = "bad host";
+			break;
+
+		case icmp_code_unreach_protocol:
+
+			type = "bad protocol";
+			break;
+
+		case icmp_code_unreach_port:
+
+			type = "bad port";
+			break;
+
+		case icmp_code_unreach_needfrag:
+
+			type = "packet dropped due to fragmentation";
+			break;
+
+		case icmp_code_unreach_srcfail:
+
+			type = "source route failed";
+			break;
+
+		case icmp_code_unreach_net_unknown:
+
+			type = "unknown network";
+			break;
+
+		case icmp_code_unreach_host_unknown:
+
+			type = "unknown host";
+			break;
+
+		case icmp_code_unreach_isolated:
+
+			type = "source host isolated";
+			break;
+
+		case icmp_code_unreach_net_prohib:
+		case icmp_code_unreach_host_prohib:
+
+			type = "prohibited access";
+			break;
+
+		case icmp_code_unreach_tosnet:
+
+			type = "bad TOS for network";
+			break;
+
+		case icmp_code_unreach_toshost:
+
+			type = "bad TOS for host";
+			break;
+
+		default:
+
+			sprintf(number,"%d",code);
+			type = number;
+			break;
+	}
+
+	if(args->Verbose)
+		FPrintf(error_output,"%s: Destination unreachable (%s) -- aborting.\n", "TFTPClient", type);
+
+	D(("Destination unreachable (%s) -- aborting.", type));
+
+	ts->ts_result = RETURN_ERROR;
+	ts->ts_state = tftp_state_finished;
+
+	LEAVE();
+}
+
+/****************************************************************************/
+
+/* The network driver could not send some of the datagrams. A datagram which
+ * was lost this way will be sent again when the transfer it belongs to runs
+ * into a timeout. But if the network device is no longer working, there is
+ * no point in trying again, and the transfer is over.
+ */
+static void
+handle_transmit_errors(BPTR error_output,const struct cmd_args * args)
+{
+	struct transmit_error te;
+	struct tftp_session * ts;
+	const char * error_text;
+	char other_error_text[40];
+	const char * wire_error_text;
+	char other_wire_error_text[40];
+	BOOL fatal;
+
+	ENTER();
+
+	while(get_transmit_error(&te))
+	{
+		error_text = get_io_error_text(te.te_Error);
+		if(error_text == NULL)
+		{
+			sprintf(other_error_text,"error=%ld",te.te_Error);
+			error_text = other_error_text;
+		}
+
+		if(te.te_WireError == 0)
+		{
+			wire_error_text = "no wire error";
+		}
+		else
+		{
+			wire_error_text = get_wire_error_text(te.te_WireError);
+			if(wire_error_text == NULL)
+			{
+				sprintf(other_wire_error_text,"wire error=%ld",te.te_WireError);
+				wire_error_text = other_wire_error_text;
+			}
+		}
+
+		fatal = (BOOL)(te.te_Error == S2ERR_OUTOFSERVICE || te.te_WireError == S2WERR_UNIT_OFFLINE);
+
+		ts = (te.te_UDPPortNumber != 0) ? find_session(te.te_UDPPortNumber) : NULL;
+		if(ts != NULL)
+		{
+			if(args->Verbose)
+			{
+				FPrintf(error_output,"%s: Could not send datagram for file \"%s\" (%s, %s)%s.\n","TFTPClient",
+					ts->ts_local_filename,error_text,wire_error_text,fatal ? " -- aborting" : "");
+			}
+
+			D(("Could not send datagram for file '%s' (%s, %s)%s.",ts->ts_local_filename,error_text,wire_error_text,fatal ? " -- aborting" : ""));
+
+			if(fatal)
+			{
+				ts->ts_result = RETURN_ERROR;
+				ts->ts_state = tftp_state_finished;
+			}
+		}
+		else
+		{
+			if(args->Verbose)
+				FPrintf(error_output,"%s: Could not send %s datagram (%s, %s).\n","TFTPClient",(te.te_PacketType == ETHERTYPE_ARP) ? "ARP" : "IP",error_text,wire_error_text);
+
+			D(("Could not send %s datagram (%s, %s).",(te.te_PacketType == ETHERTYPE_ARP) ? "ARP" : "IP",error_text,wire_error_text));
+		}
+	}
+
+	LEAVE();
+}
+
+/****************************************************************************/
+
+/* The server did not respond to the session in time. */
+static void
+handle_session_timeout(BPTR error_output,const struct cmd_args * args,struct tftp_session * ts)
+{
+	ENTER();
+
+	select_session(ts);
+
+	/* We will not wait indefinitely for a client which
+	 * no longer responds.
+	 */
+	if(ts->ts_server && NOT (ts->ts_state == tftp_state_write_to_file && ts->ts_last_block_transmitted))
+	{
+		ts->ts_num_retransmissions++;
+
+		if(ts->ts_num_retransmissions > MAX_SERVER_RETRANSMISSIONS)
+		{
+			if(args->Verbose)
+				FPrintf(error_output, "%s: Client does not respond -- aborting.\n","TFTPClient");
+
+			D(("Client does not respond -- aborting."));
+
+			ts->ts_result = RETURN_ERROR;
+			ts->ts_state = tftp_state_finished;
+			goto out;
+		}
+	}
+
+	/* No response to the ARP request has arrived yet? */
+	if (ts->ts_state == tftp_state_request_ethernet_address)
+	{
+		if(ts->ts_num_arp_resolution_attempts == 0)
+		{
+			if(args->Verbose)
+				FPrintf(error_output, "%s: No response to ARP query received -- aborting.\n","TFTPClient");
+			
+			D(("No response to ARP query received -- aborting."));
+
+			ts->ts_result = RETURN_ERROR;
+			ts->ts_state = tftp_state_finished;
+			goto out;
+		}
+
+		if(args->Verbose)
+			Printf("Repeating ARP query...\n");
+		
+		D(("Repeating ARP query."));
+
+		broadcast_arp_query(ts->ts_remote_ipv4_address);
+
+		ts->ts_num_arp_resolution_attempts--;
+
+		D(("starting the timer"));
+
+		start_session_timer(ts,ARP_QUERY_TIMEOUT);
+	}
+	/* The server has not replied to our write/read request yet? */
+	else if (ts->ts_state == tftp_state_request_write || ts->ts_state == tftp_state_request_read)
+	{
+		if(args->Verbose)
+			Printf("Trying to begin transmission of file \"%s\" again.\n", ts->ts_local_filename);
+		
+		D(("Trying to begin transmission of file '%s' again.", ts->ts_local_filename));
+		
+		start_tftp(ts->ts_state == tftp_state_request_write ? TFTP_PACKET_WRQ : TFTP_PACKET_RRQ,
+			ts->ts_remote_filename,ts->ts_options,ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+
+		rto_cancel_timing(&ts->ts_rto);
+		rto_backoff(&ts->ts_rto);
+
+		D(("starting the timer"));
+
+		start_session_timer(ts,ts->ts_rto.re_rto);
+	}
+	/* The client has not acknowledged the options yet? */
+	else if (ts->ts_state == tftp_state_option_acknowledgement)
+	{
+		if(args->Verbose)
+			Printf("Sending the option acknowledgement again.\n");
+
+		D(("Sending the option acknowledgement again."));
+
+		send_tftp_option_acknowledgement(ts->ts_options,ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+
+		rto_cancel_timing(&ts->ts_rto);
+		rto_backoff(&ts->ts_rto);
+
+		D(("starting the timer"));
+
+		start_session_timer(ts,ts->ts_rto.re_rto);
+	}
+	/* The server has not yet acknowledged the receipt of the blocks we sent to it? */
+	else if (ts->ts_state == tftp_state_read_from_file)
+	{
+		if(args->Verbose)
+			Printf("Sending the blocks starting with #%ld again.\n",ts->ts_first_unacknowledged_block);
+		
+		D(("Sending the blocks starting with #%ld again.",ts->ts_first_unacknowledged_block));
+
+		ts->ts_next_block_to_send = ts->ts_first_unacknowledged_block;
+
+		rto_backoff(&ts->ts_rto);
+
+		ts->ts_send_window = TRUE;
+	}
+	/* The server has not yet sent the next block to write? */
+	else if (ts->ts_state == tftp_state_write_to_file)
+	{
+		if(ts->ts_last_block_transmitted)
+		{
+			ts->ts_num_eof_acknowledgements--;
+			if(ts->ts_num_eof_acknowledgements == 0)
+			{
+				if(args->Verbose)
+					Printf("Transmission completed.\n");
+				
+				D(("Transmission completed."));
+
+				ts->ts_result = RETURN_OK;
+				ts->ts_state = tftp_state_finished;
+				goto out;
+			}
+		}
+
+		/* If we are serving files and the client has yet to send
+		 * the first block, it may not have received the option
+		 * acknowledgement.
+		 */
+		if(ts->ts_server && ts->ts_block_number == 1 && ts->ts_options != NULL)
+		{
+			if(args->Verbose)
+				Printf("Sending the option acknowledgement again.\n");
+
+			D(("Sending the option acknowledgement again."));
+
+			send_tftp_option_acknowledgement(ts->ts_options,ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+		}
+		else
+		{
+			if(args->Verbose)
+				Printf("Acknowledging receipt of block #%ld again.\n",ts->ts_block_number-1);
+
+			D(("Acknowledging receipt of block #%ld again.",ts->ts_block_number-1));
+
+			send_tftp_acknowledgement(get_wire_block_number(ts->ts_block_number-1,ts->ts_rollover),ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+		}
+
+		rto_cancel_timing(&ts->ts_rto);
+		rto_backoff(&ts->ts_rto);
+
+		ts->ts_blocks_since_acknowledgement = 0;
+
+		D(("starting the timer"));
+
+		start_session_timer(ts,ts->ts_rto.re_rto);
+	}
+
+ out:
+
+	LEAVE();
+}
+
+/****************************************************************************/
+
+/* Read the block which follows the last one read from the file into
+ * its slot in the window buffer. Returns OK on success, and FAILURE
+ * otherwise, in which case the transfer is over.
+ */
+static int
+read_session_block(BPTR error_output,const struct cmd_args * args,struct tftp_session * ts)
+{
+	int block = ts->ts_last_block_read + 1;
+	int slot = (block - 1) % get_num_window_slots(ts);
+	struct tftphdr * tftp_output = (struct tftphdr *)&ts->ts_window_buffer[slot * window_slot_size];
+	LONG num_bytes_read;
+	ULONG position;
+	int result = FAILURE;
+
+	/* If the file was loaded into memory, the block will be
+	 * sent straight from there, and there is nothing to read.
+	 */
+	if(ts->ts_file_image != NULL)
+	{
+		position = (ULONG)(block - 1) * ts->ts_blksize;
+
+		if(position < ts->ts_file_image->fi_Size)
+			num_bytes_read = ts->ts_file_image->fi_Size - position;
+		else
+			num_bytes_read = 0;
+
+		if(num_bytes_read > ts->ts_blksize)
+			num_bytes_read = ts->ts_blksize;
+
+		goto got_block;
+	}
+
+	if(ts->ts_file_buffer_size == 0)
+		set_file_buffer(args,ts,ts->ts_source_file,ts->ts_from_path,TRUE);
+
+	if(args->Verbose)
+		Printf("Reading block #%ld.\n",block);
+
+	D(("Reading block #%ld.",block));
+
+	SetIoErr(0);
+
+	num_bytes_read = FRead(ts->ts_source_file,tftp_output->th_data,1,ts->ts_blksize);
+	if(num_bytes_read == 0 && IoErr() != 0)
+	{
+		TEXT error_message[256];
+
+		Fault(IoErr(),NULL,error_message,sizeof(error_message));
+
+		if(!args->Quiet)
+			FPrintf(error_output, "%s: Error reading from file \"%s\" (%s).\n","TFTPClient",ts->ts_from_path,error_message);
+
+		D(("Error reading from file '%s' (%s).",ts->ts_from_path,error_message));
+
+		send_tftp_error(TFTP_ERROR_UNDEF,"Error reading from file",ts->ts_client_udp_port_number,ts->ts_server_udp_port_number);
+
+		ts->ts_result = RETURN_ERROR;
+		ts->ts_state = tftp_state_finished;
+		goto out;
+	}
+
+ got_block:
+
+	ts->ts_last_block_read = block;
+
+	/* Did we just read the last data to be transmitted? */
+	if(num_bytes_read < ts->ts_blksize)
+	{
+		ts->ts_final_block = block;
+
+		if(args->Verbose)
+			Printf("This is the last block to be read.\n");
+
+		D(("This is the last block to be read."));
+	}
+
+	tftp_output->th_opcode	= TFTP_PACKET_DATA;
+	tftp_output->th_block	= get_wire_block_number(block,ts->ts_rollover);
+
+	ts->ts_window_slot_length[slot] = offsetof(struct tftphdr, th_data) + num_bytes_read;
+
+	result = OK;
+
+ out:
+
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Send the next blocks of the file, as many as the window will hold, to
+ * the server. Then read the blocks which follow the window, so that the
+ * server will not have to wait for them once it has acknowledged the
+ * window.
+ */
+static void
+send_session_window(BPTR error_output,const struct cmd_args * args,struct tftp_session * ts)
+{
+	struct tftphdr * tftp_output;
+	int slot;
+
+	ENTER();
+
+	select_session(ts);
+
+	ts->ts_send_window = FALSE;
+
+	while(ts->ts_next_block_to_send < ts->ts_first_unacknowledged_block + ts->ts_windowsize && (ts->ts_final_block == 0 || ts->ts_next_block_to_send <= ts->ts_final_block))
+	{
+		slot = (ts->ts_next_block_to_send - 1) % get_num_window_slots(ts);
+
+		tftp_output = (struct tftphdr *)&ts->ts_window_buffer[slot * window_slot_size];
+
+		/* The block should have been read ahead of time. If
+		 * it was not, the server has to wait while it is read.
+		 */
+		if(ts->ts_next_block_to_send > ts->ts_last_block_read)
+		{
+			ULONG stall_start = get_milliseconds();
+
+			if(read_session_block(error_output,args,ts) != OK)
+				goto out;
+
+			ts->ts_stall_time += get_milliseconds() - stall_start;
+			ts->ts_num_stalled_blocks++;
+		}
+
+		/* We may be sending this block again. */
+		ts->ts_window_slot_resent[slot] = (BOOL)(ts->ts_next_block_to_send <= ts->ts_last_block_sent);
+
+		if(args->Verbose)
+			Printf("Sending block #%ld (%ld bytes).\n",ts->ts_next_block_to_send,ts->ts_window_slot_length[slot] - offsetof(struct tftphdr, th_data));
+		
+		D(("Sending block #%ld (%ld bytes).",ts->ts_next_block_to_send,ts->ts_window_slot_length[slot] - offsetof(struct tftphdr, th_data)));
+
+		/* The window buffer holds only the TFTP header if the data
+		 * is in the file image, in which case the packet is put
+		 * together in the transmission buffer.
+		 */
+		if(ts->ts_file_image != NULL)
+		{
+			struct tftphdr * th = (struct tftphdr *)get_udp_payload_buffer(NULL);
+			int data_length = ts->ts_window_slot_length[slot] - offsetof(struct tftphdr, th_data);
+			ULONG payload_sum;
+
+			th->th_opcode	= tftp_output->th_opcode;
+			th->th_block	= tftp_output->th_block;
+
+			/* The checksum of the TFTP header is the sum of its two
+			 * 16 bit words. The data is added to it while it is
+			 * being copied.
+			 */
+			payload_sum = (ULONG)(UWORD)th->th_opcode + (UWORD)th->th_block;
+
+			payload_sum = in_cksum_copy(th->th_data,&ts->ts_file_image->fi_Data[(ULONG)(ts->ts_next_block_to_send - 1) * ts->ts_blksize],data_length,payload_sum);
+
+			num_udp_bytes_copied += data_length;
+
+			send_udp_datagram(ts->ts_client_udp_port_number,ts->ts_server_udp_port_number,ts->ts_window_slot_length[slot],payload_sum);
+		}
+		else
+		{
+			send_udp(ts->ts_client_udp_port_number,ts->ts_server_udp_port_number,tftp_output,ts->ts_window_slot_length[slot]);
+		}
+
+		ts->ts_window_slot_time[slot] = get_milliseconds();
+
+		if(NOT ts->ts_window_slot_resent[slot])
+		{
+			add_to_quad(&ts->ts_num_bytes_transferred,ts->ts_window_slot_length[slot] - offsetof(struct tftphdr, th_data));
+
+			ts->ts_last_block_sent = ts->ts_next_block_to_send;
+			ts->ts_num_blocks_sent++;
+
+			if(ts->ts_next_block_to_send == ts->ts_final_block)
+				ts->ts_last_block_transmitted = TRUE;
+		}
+
+		ts->ts_next_block_to_send++;
+	}
+
+	D(("starting the timer"));
+
+	start_session_timer(ts,ts->ts_rto.re_rto);
+
+	/* While the server is busy with the window, read the blocks
+	 * which follow it, as far as there is room for them.
+	 */
+	while(ts->ts_final_block == 0 && ts->ts_last_block_read < ts->ts_first_unacknowledged_block - 1 + get_num_window_slots(ts))
+	{
+		if(read_session_block(error_output,args,ts) != OK)
+			goto out;
+	}
 
  out:
 
-	RETURN(result);
-	return(result);
+	LEAVE();
 }
 
 /****************************************************************************/
 
-int
-main(int argc,char ** argv)
+/* Close the files of a transfer which has finished, one way or another. */
+static void
+end_session(const struct cmd_args * args,struct tftp_session * ts)
 {
-	/* The TFTP exchange rattles through the following
-	 * steps until the transmission has completed or an
-	 * error has occured.
+	char total_num_bytes_text[QUAD_STRING_SIZE];
+
+	ENTER();
+
+	if(args->Verbose)
+		Printf("A total of %s bytes were transmitted.\n",convert_quad_to_string(&ts->ts_num_bytes_transferred,total_num_bytes_text));
+	
+	D(("A total of %s bytes were transmitted.",convert_quad_to_string(&ts->ts_num_bytes_transferred,total_num_bytes_text)));
+
+	if(ts->ts_file_buffer_size > 0)
+	{
+		if(args->Verbose)
+			Printf("The file buffer size was %lu bytes (file system block size %ld bytes).\n",ts->ts_file_buffer_size,ts->ts_file_system_block_size);
+
+		D(("The file buffer size was %lu bytes (file system block size %ld bytes).",ts->ts_file_buffer_size,ts->ts_file_system_block_size));
+	}
+
+	if(ts->ts_num_staging_writes > 0)
+	{
+		if(args->Verbose)
+			Printf("The data received was written to the file in %lu parts.\n",ts->ts_num_staging_writes);
+
+		D(("The data received was written to the file in %lu parts.",ts->ts_num_staging_writes));
+	}
+
+	/* How long did the server have to wait for blocks which were
+	 * not read ahead of time?
+	 */
+	if(ts->ts_num_blocks_sent > 0)
+	{
+		if(args->Verbose)
+		{
+			Printf("%lu of %lu blocks were not read ahead in time (%lu ms in total, %lu ms per block).\n",
+				ts->ts_num_stalled_blocks,ts->ts_num_blocks_sent,ts->ts_stall_time,ts->ts_stall_time / ts->ts_num_blocks_sent);
+		}
+
+		D(("%lu of %lu blocks were not read ahead in time (%lu ms in total, %lu ms per block).",
+			ts->ts_num_stalled_blocks,ts->ts_num_blocks_sent,ts->ts_stall_time,ts->ts_stall_time / ts->ts_num_blocks_sent));
+	}
+
+	/* If the transmission did not complete, do not leave
+	 * the unused preallocated space behind.
+	 */
+	if(ts->ts_destination_file_preallocated && NOT quad_equals(&ts->ts_num_bytes_transferred,ts->ts_transfer_size))
+	{
+		Flush(ts->ts_destination_file);
+
+		SetFileSize(ts->ts_destination_file,ts->ts_num_bytes_transferred.s2q_Low,OFFSET_BEGINNING);
+	}
+
+	if(ts->ts_file_image != NULL)
+	{
+		release_file_image(ts->ts_file_image);
+		ts->ts_file_image = NULL;
+	}
+
+	if(ts->ts_source_file != (BPTR)NULL)
+		Close(ts->ts_source_file);
+
+	/* If a file was created to stored the received data
+	 * in, close it and perform some postprocessing
+	 * on it.
 	 */
-	enum tftp_state_t
+	if(ts->ts_destination_file != (BPTR)NULL)
+	{
+		Close(ts->ts_destination_file);
+
+		if(ts->ts_to_path != NULL)
+		{
+			/* Delete an incomplete file. */
+			if(ts->ts_delete_destination_file)
+				DeleteFile(ts->ts_to_path);
+			/* Keep the file, but mark it as not executable,
+			 * just to be safe.
+			 */
+			else
+				SetProtection(ts->ts_to_path, FIBF_EXECUTE);
+		}
+	}
+
+	if(ts->ts_window_buffer != NULL)
+	{
+		FreeVec(ts->ts_window_buffer);
+		ts->ts_window_buffer = NULL;
+	}
+
+	if(ts->ts_staging_buffer != NULL)
+	{
+		FreeVec(ts->ts_staging_buffer);
+		ts->ts_staging_buffer = NULL;
+	}
+
+	if(ts->ts_server_names != NULL)
+	{
+		FreeVec(ts->ts_server_names);
+		ts->ts_server_names = NULL;
+	}
+
+	if(ts->ts_multicast)
 	{
-		tftp_state_request_ethernet_address,
-		tftp_state_request_read,
-		tftp_state_request_write,
-		tftp_state_write_to_file,
-		tftp_state_read_from_file,
-	};
+		leave_multicast_group(ts->ts_multicast_ipv4_address);
+		ts->ts_multicast = FALSE;
+	}
+
+	if(ts->ts_block_map != NULL)
+	{
+		FreeVec(ts->ts_block_map);
+		ts->ts_block_map = NULL;
+	}
 
-	enum tftp_state_t tftp_state = tftp_state_request_ethernet_address;
+	LEAVE();
+}
+
+/****************************************************************************/
 
+int
+main(int argc,char ** argv)
+{
 	struct RDArgs * rda = NULL;
 	int result = RETURN_FAIL;
 	struct cmd_args args;
 	TEXT device_name[256];
 	LONG device_unit;
 	TEXT local_ip_address[20];
-	STRPTR local_filename;
-	STRPTR remote_filename;
-	ULONG from_ipv4_address;
-	STRPTR from_path;
-	ULONG to_ipv4_address;
-	STRPTR to_path = NULL;
+	struct MinList transfer_list;
+	struct transfer_node * tn;
+	int num_transfers = 0;
+	int num_transfers_completed = 0;
+	struct tftp_session * ts;
+	struct tftp_session * next_ts;
+	int num_sessions = 0;
 	ULONG signals_received;
-	ULONG time_signal_mask, net_signal_mask, signal_mask;
-	int num_arp_resolution_attempts = 4;
-	BPTR source_file = (BPTR)NULL;
-	BPTR destination_file = (BPTR)NULL;
-	BOOL delete_destination_file = FALSE;
-	int client_udp_port_number;
-	int server_udp_port_number = TFTP_PORT_NUMBER;
-	BOOL server_udp_port_number_known = FALSE;
-	UBYTE tftp_packet[2 * sizeof(UWORD) + SEGSIZE]; /* opcode and block, followed by data */
-	struct tftphdr * tftp_output = (struct tftphdr *)tftp_packet;
-	int tftp_output_length = 0;
-	int tftp_payload_length = 0;
-	int block_number = 1;
-	BOOL last_block_transmitted = FALSE;
-	int num_eof_acknowledgements = 3;
-	LONG total_num_bytes_transferred = 0;
+	ULONG time_signal_mask, net_signal_mask, net_write_signal_mask, disk_write_signal_mask, signal_mask;
+	ULONG now;
+	S2QUAD total_num_bytes_transferred;
+	char num_bytes_text[QUAD_STRING_SIZE];
+	TEXT peer_name[16 + SEGSIZE];
+	STRPTR source;
+	STRPTR destination;
 	const struct Process * this_process = (struct Process *)FindTask(NULL);
 	BPTR error_output = this_process->pr_CES != (BPTR)NULL ? this_process->pr_CES : Output();
-	char ipv4_address[20];
-	const char * from_computer;
-	const char * to_computer;
 
 	SETDEBUGLEVEL(DEBUGLEVEL_CallTracing);
 
+	NewList((struct List *)&transfer_list);
+	NewList((struct List *)&session_list);
+
 	memset(&args,0,sizeof(args));
+	memset(&total_num_bytes_transferred,0,sizeof(total_num_bytes_transferred));
 
 	if(((struct Library *)DOSBase)->lib_Version < 37)
 	{
@@ -347,82 +3346,153 @@ main(int argc,char ** argv)
 			goto out;
 		}
 
-		server_udp_port_number = remote_port;
+		default_server_udp_port_number = remote_port;
 	}
 
-	/* The source is either a file name ("example"), or a file name with
-	 * an IPv4 address prefix, like a device name ("192.168.0.1:example").
-	 */
-	get_ipv4_address_and_path_from_name(args.Source, &from_ipv4_address, &from_path);
+	if(args.WindowSize != NULL)
+	{
+		LONG window_size = (*args.WindowSize);
 
-	if(from_ipv4_address == local_ipv4_address || from_ipv4_address == 0x7F000001)
-		from_ipv4_address = 0;
+		if(window_size < 1 || window_size > MAX_WINDOWSIZE)
+		{
+			if(!args.Quiet)
+				FPrintf(error_output, "%s: Window size %ld is out of range; valid range is 1..%ld, default is %ld.\n","TFTPClient",window_size,MAX_WINDOWSIZE,DEFAULT_WINDOWSIZE);
 
-	/* The file name is mandatory. */
-	if((*from_path) == '\0')
+			goto out;
+		}
+
+		requested_windowsize = window_size;
+	}
+
+	if(args.BufferSize != NULL)
 	{
-		if(!args.Quiet)
-			FPrintf(error_output, "%s: FROM argument \"%s\" must include a file name.\n","TFTPClient", args.Source);
+		LONG buffer_size = (*args.BufferSize);
 
-		goto out;
+		if(buffer_size < MIN_FILE_BUFFER_SIZE || buffer_size > MAX_FILE_BUFFER_SIZE)
+		{
+			if(!args.Quiet)
+				FPrintf(error_output, "%s: Buffer size %ld is out of range; valid range is %ld..%ld bytes.\n","TFTPClient",buffer_size,MIN_FILE_BUFFER_SIZE,MAX_FILE_BUFFER_SIZE);
+
+			goto out;
+		}
 	}
 
-	/* The destination is either a file name ("example"), or a file name with
-	 * an IPv4 address prefix, like a device name ("192.168.0.1:example").
-	 */
-	get_ipv4_address_and_path_from_name(args.Destination, &to_ipv4_address, &to_path);
+	if(args.Timeout != NULL)
+	{
+		LONG timeout = (*args.Timeout);
+
+		if(timeout < MIN_TIMEOUT || timeout > MAX_TIMEOUT)
+		{
+			if(!args.Quiet)
+				FPrintf(error_output, "%s: Timeout %ld is out of range; valid range is %ld..%ld milliseconds, default is %ld.\n","TFTPClient",timeout,MIN_TIMEOUT,MAX_TIMEOUT,DEFAULT_TIMEOUT);
 
-	if((*to_path) == '\0')
-		to_path = (STRPTR)FilePart(from_path);
+			goto out;
+		}
 
-	if(to_ipv4_address == local_ipv4_address || to_ipv4_address == 0x7F000001)
-		to_ipv4_address = 0;
+		retransmit_timeout = timeout;
+	}
 
-	if(to_ipv4_address == 0xFFFFFFFFUL)
+	if(args.Sessions != NULL)
 	{
-		if(!args.Quiet)
-			FPrintf(error_output, "%s: '%s' is not a valid IPv4 destination address.\n","TFTPClient",args.Destination);
+		LONG sessions = (*args.Sessions);
 
-		goto out;
+		if(sessions < 1 || sessions > MAX_SESSIONS)
+		{
+			if(!args.Quiet)
+				FPrintf(error_output, "%s: Number of sessions %ld is out of range; valid range is 1..%ld, default is %ld.\n","TFTPClient",sessions,MAX_SESSIONS,DEFAULT_SESSIONS);
+
+			goto out;
+		}
+
+		max_sessions = sessions;
+	}
+	/* When serving files, as many clients as possible
+	 * should be able to use the server at the same time.
+	 */
+	else if (args.Server)
+	{
+		max_sessions = MAX_SESSIONS;
 	}
 
-	if(from_ipv4_address != 0 && to_ipv4_address != 0)
+	/* The files to be transferred may be given by the FROM and TO
+	 * parameters, as further pairs of names following them, and
+	 * through a list read from a file.
+	 */
+	if(args.Source != NULL)
 	{
-		if(!args.Quiet)
-			FPrintf(error_output, "%s: Please provide a source or destination IPv4 address, but not both.\n","TFTPClient");
+		if(args.Destination == NULL)
+		{
+			if(!args.Quiet)
+				FPrintf(error_output, "%s: Required %s argument is missing.\n","TFTPClient", "TO");
 
-		goto out;
+			goto out;
+		}
+
+		if(add_transfer(&transfer_list,args.Source,args.Destination) != OK)
+		{
+			if(!args.Quiet)
+				PrintFault(ERROR_NO_FREE_STORE,"TFTPClient");
+
+			goto out;
+		}
 	}
 
-	if(from_ipv4_address == to_ipv4_address)
+	if(args.Pairs != NULL)
 	{
-		if(!args.Quiet)
-			FPrintf(error_output, "%s: Please provide either a source or destination IPv4 address.\n","TFTPClient");
+		STRPTR * pairs = args.Pairs;
 
-		goto out;
+		while(pairs[0] != NULL)
+		{
+			if(pairs[1] == NULL)
+			{
+				if(!args.Quiet)
+					FPrintf(error_output, "%s: Source \"%s\" must be followed by a destination.\n","TFTPClient", pairs[0]);
+
+				goto out;
+			}
+
+			if(add_transfer(&transfer_list,pairs[0],pairs[1]) != OK)
+			{
+				if(!args.Quiet)
+					PrintFault(ERROR_NO_FREE_STORE,"TFTPClient");
+
+				goto out;
+			}
+
+			pairs += 2;
+		}
 	}
 
-	if(from_ipv4_address != 0)
+	if(args.List != NULL)
 	{
-		local_filename		= to_path;
-		remote_ipv4_address	= from_ipv4_address;
-		remote_filename		= from_path;
+		if(read_transfer_list(error_output,&args,args.List,&transfer_list) != OK)
+			goto out;
 	}
-	else
+
+	for(tn = (struct transfer_node *)transfer_list.mlh_Head ;
+	    tn->tn_MinNode.mln_Succ != NULL ;
+	    tn = (struct transfer_node *)tn->tn_MinNode.mln_Succ)
 	{
-		local_filename		= from_path;
-		remote_ipv4_address	= to_ipv4_address;
-		remote_filename		= to_path;
+		num_transfers++;
 	}
 
-	/* Make sure that the file name is not too long to be transmitted safely. */
-	if(offsetof(struct tftphdr, th_data) + strlen(remote_filename) + 1 + strlen("octet") + 1 > sizeof(tftp_packet))
+	/* When serving files, the clients will tell us which
+	 * files to transfer.
+	 */
+	if(args.Server)
 	{
-		if(!args.Quiet)
+		if(num_transfers > 0)
 		{
-			FPrintf(error_output, "%s: File name \"%s\" is too long (up to %ld characters are allowed).\n","TFTPClient",
-				remote_filename,sizeof(tftp_packet) - (offsetof(struct tftphdr, th_data) + 1 + strlen("octet") + 1));
+			if(!args.Quiet)
+				FPrintf(error_output, "%s: The SERVER option cannot be used together with files to be transferred.\n","TFTPClient");
+
+			goto out;
 		}
+	}
+	else if (num_transfers == 0)
+	{
+		if(!args.Quiet)
+			FPrintf(error_output, "%s: Required %s argument is missing.\n","TFTPClient", "FROM");
 
 		goto out;
 	}
@@ -431,181 +3501,203 @@ main(int argc,char ** argv)
 	if(setup(error_output, &args) < 0)
 		goto out;
 
-	if(from_ipv4_address == 0)
-	{
-		sprintf(ipv4_address,"%lu.%lu.%lu.%lu",
-			(to_ipv4_address >> 24) & 0xff,
-			(to_ipv4_address >> 16) & 0xff,
-			(to_ipv4_address >>  8) & 0xff,
-			 to_ipv4_address        & 0xff);
+	/* The largest data block which we can request is limited by how much
+	 * data fits into a single IP datagram, given the maximum transmission
+	 * unit size of the network device. We will ask the server to use that
+	 * block size, and fall back to the default of 512 bytes if it declines.
+	 */
+	max_blksize = net_mtu - (sizeof(struct ip) + sizeof(struct udphdr) + offsetof(struct tftphdr, th_data));
+	if(max_blksize > MAX_BLKSIZE)
+		max_blksize = MAX_BLKSIZE;
 
-		from_computer	= "this computer";
-		to_computer		= ipv4_address;
-	}
-	else
-	{
-		sprintf(ipv4_address,"%lu.%lu.%lu.%lu",
-			(from_ipv4_address >> 24) & 0xff,
-			(from_ipv4_address >> 16) & 0xff,
-			(from_ipv4_address >>  8) & 0xff,
-			 from_ipv4_address        & 0xff);
+	if(max_blksize < SEGSIZE)
+		max_blksize = SEGSIZE;
 
-		from_computer	= ipv4_address;
-		to_computer		= "this computer";
-	}
+	/* Received data is written to the files by a process of its
+	 * own, which writes whatever each transfer has collected in
+	 * its staging buffer.
+	 */
+	if(disk_writer_setup(error_output,&args) != OK)
+		goto out;
 
-	if(args.Verbose)
+	/* When sending a file, we need to hold on to each data block
+	 * until the server has acknowledged it, just in case it needs
+	 * to be sent again. Each transfer which sends a file has room
+	 * for a whole window of blocks, and for the blocks read ahead.
+	 */
+	window_slot_size = offsetof(struct tftphdr, th_data) + max_blksize;
+
+	/* Port numbers may have to be picked pseudo-randomly. */
+	srand(time(NULL));
+
+	/* Now transfer the files, as many of them at the same time as
+	 * permitted. The result reflects the worst outcome of all the
+	 * transfers.
+	 */
+	result = RETURN_OK;
+
+	time_signal_mask	= (1UL << time_port->mp_SigBit);
+	net_signal_mask		= (1UL << net_read_port->mp_SigBit);
+	net_write_signal_mask	= (1UL << net_write_port->mp_SigBit);
+	disk_write_signal_mask	= (1UL << disk_write_reply_port->mp_SigBit);
+
+	signal_mask = SIGBREAKF_CTRL_C | time_signal_mask | net_signal_mask | net_write_signal_mask | disk_write_signal_mask;
+	signals_received = 0;
+
+	tn = (struct transfer_node *)transfer_list.mlh_Head;
+
+	if(args.Server)
 	{
-		Printf("Copy \"%s\" (%s) to \"%s\" (%s)\n",
-			from_path,
-			from_computer,
-			to_path,
-			to_computer);
-	}
+		if(args.Verbose)
+			Printf("Waiting for requests on UDP port %ld...\n",default_server_udp_port_number);
 
-	D(("Will copy \"%s\" (%s) to \"%s\" (%s).",
-		from_path,
-		from_computer,
-		to_path,
-		to_computer
-	));
+		D(("Waiting for requests on UDP port %ld.",default_server_udp_port_number));
+	}
 
-	/* We are sending a file? */
-	if(from_ipv4_address == 0)
+	while(TRUE)
 	{
-		source_file = Open(from_path, MODE_OLDFILE);
-		if(source_file == (BPTR)NULL)
+		/* Begin as many transfers as may be in progress at the same time. */
+		while(NOT stop_transfers && num_sessions < max_sessions && tn->tn_MinNode.mln_Succ != NULL)
 		{
-			TEXT error_message[256];
+			ts = AllocVec(sizeof(*ts), MEMF_ANY|MEMF_PUBLIC|MEMF_CLEAR);
+			if(ts == NULL)
+			{
+				if(!args.Quiet)
+					PrintFault(ERROR_NO_FREE_STORE,"TFTPClient");
 
-			Fault(IoErr(),NULL,error_message,sizeof(error_message));
+				D(("Could not allocate TFTP session."));
 
-			if(!args.Quiet)
-				FPrintf(error_output, "%s: Could not open file \"%s\" for reading (%s).\n","TFTPClient",from_path,error_message);
+				result = RETURN_FAIL;
+				goto out;
+			}
 
-			D(("Could not open file '%s' for reading (%s).",from_path,error_message));
+			ts->ts_transfer = tn;
 
-			goto out;
-		}
+			AddTail((struct List *)&session_list,(struct Node *)ts);
+			num_sessions++;
+
+			/* A transfer which cannot even begin will be
+			 * reported together with those which have
+			 * finished.
+			 */
+			if(start_session(error_output,&args,ts) != OK)
+				ts->ts_state = tftp_state_finished;
 
-		D(("Opened '%s' for reading.", from_path));
+			tn = (struct transfer_node *)tn->tn_MinNode.mln_Succ;
+		}
 
-		/* Use a read buffer. */
-		SetVBuf(source_file,NULL,BUF_FULL,8192);
-	}
-	/* We are receiving a file. */
-	else
-	{
-		/* Unless specifically requested, we verify that the
-		 * file to write to does not yet exist and exit with
-		 * error if does.
+		/* Report on the transfers which have finished, making
+		 * room for the next ones.
 		 */
-		if(!args.Overwrite)
+		for(ts = (struct tftp_session *)session_list.mlh_Head ;
+		    (next_ts = (struct tftp_session *)ts->ts_MinNode.mln_Succ) != NULL ;
+		    ts = next_ts)
 		{
-			BPTR test_lock;
+			if(ts->ts_state != tftp_state_finished)
+				continue;
 
-			test_lock = Lock(to_path, EXCLUSIVE_LOCK);
-			if(test_lock == (BPTR)NULL)
-			{
-				/* It's acceptable if the file in question does
-				 * not exist yet. But everything else we count
-				 * as an error, report it and abort.
-				 */
-				if(IoErr() != ERROR_OBJECT_NOT_FOUND)
-				{
-					TEXT error_message[256];
+			/* The transfer is only complete once all the data
+			 * received has been written.
+			 */
+			wait_for_session_writes(error_output,&args,ts);
 
-					Fault(IoErr(),NULL,error_message,sizeof(error_message));
+			end_session(&args,ts);
 
-					if(!args.Quiet)
-						FPrintf(error_output, "%s: Could not check if file \"%s\" exists (%s).\n","TFTPClient",to_path,error_message);
+			/* When serving files, each request which made sense
+			 * counts as a transfer. How well the transfers went
+			 * does not affect the result, though.
+			 */
+			if(ts->ts_server)
+			{
+				if(ts->ts_remote_filename != NULL)
+				{
+					num_transfers++;
 
-					D(("Could not check if file '%s' exists (%s).",to_path,error_message));
+					sprintf(peer_name,"%lu.%lu.%lu.%lu:%s",
+						(ts->ts_remote_ipv4_address >> 24) & 0xff,
+						(ts->ts_remote_ipv4_address >> 16) & 0xff,
+						(ts->ts_remote_ipv4_address >>  8) & 0xff,
+						 ts->ts_remote_ipv4_address        & 0xff,
+						ts->ts_remote_filename);
 
-					goto out;
+					if(ts->ts_from_path != NULL)
+					{
+						source		= ts->ts_from_path;
+						destination	= peer_name;
+					}
+					else
+					{
+						source		= peer_name;
+						destination	= ts->ts_to_path;
+					}
+				}
+				else
+				{
+					source = destination = NULL;
 				}
 			}
-			/* The file already exists. */
 			else
 			{
-				UnLock(test_lock);
-
-				if(!args.Quiet)
-					Printf("%s: Destination file \"%s\" already exists. Use OVERWRITE argument to replace it.\n","TFTPClient",to_path);
+				if(result < ts->ts_result)
+					result = ts->ts_result;
 
-				D(("Destination file '%s' already exists.",to_path));
-
-				result = RETURN_WARN;
-				goto out;
+				source		= ts->ts_transfer->tn_Source;
+				destination	= ts->ts_transfer->tn_Destination;
 			}
-		}
 
-		/* This will either create or overwrite the file. */
-		destination_file = Open(to_path, MODE_NEWFILE);
-		if(destination_file == (BPTR)NULL)
-		{
-			TEXT error_message[256];
+			if(source != NULL)
+			{
+				if(ts->ts_result == RETURN_OK)
+					num_transfers_completed++;
 
-			Fault(IoErr(),NULL,error_message,sizeof(error_message));
+				add_quads(&total_num_bytes_transferred,&ts->ts_num_bytes_transferred);
 
-			if(!args.Quiet)
-				FPrintf(error_output, "%s: Could not open file \"%s\" for writing (%s).\n","TFTPClient",to_path,error_message);
+				/* Report on each file, unless there is only one. */
+				if((num_transfers > 1 || args.Server) && !args.Quiet)
+				{
+					Printf("%s -> %s: %s (%s bytes).\n",source,destination,
+						(ts->ts_result == RETURN_OK) ? "done" : "failed",
+						convert_quad_to_string(&ts->ts_num_bytes_transferred,num_bytes_text));
+				}
+			}
 
-			D(("Could not open file '%s' for writing (%s).",to_path,error_message));
+			Remove((struct Node *)ts);
+			FreeVec(ts);
 
-			goto out;
+			num_sessions--;
 		}
-		
-		D(("Opened '%s' for writing.", to_path));
-
-		/* Use a write buffer. */
-		SetVBuf(destination_file,NULL,BUF_FULL,8192);
-
-		/* Delete an empty file. */
-		delete_destination_file = TRUE;
-	}
-
-	/* We need to send UDP datagrams using a specific port number, which
-	 * uniquely identifies the TFTP session. This picks an "ephemeral"
-	 * port number, which should be in the range 49152..65535.
-	 */
-	if(UtilityBase != NULL && UtilityBase->lib_Version >= 39)
-	{
-		/* Really use a unique ID. */
-		client_udp_port_number = 49152 + (GetUniqueID() % 16384);
-	}
-	else
-	{
-		/* Try to get by with a pseudo-randomly chosen port. */
-		srand(time(NULL));
-
-		client_udp_port_number = 49152 + (rand() % 16384);
-	}
-
-	D(("client udp port number = %ld", client_udp_port_number));
-
-	if(args.Verbose)
-		Printf("Sending ARP query...\n");
 
-	SHOWMSG("Sending ARP query.");
+		/* Are we finished? When serving files, we keep going
+		 * until told to stop.
+		 */
+		if(num_sessions == 0)
+		{
+			if(stop_transfers || (NOT args.Server && tn->tn_MinNode.mln_Succ == NULL))
+				break;
 
-	/* We need to know the Ethernet address corresponding to the IPv4
-	 * address of the remote TFTP server.
-	 */
-	broadcast_arp_query(remote_ipv4_address);
+			if(NOT args.Server)
+				continue;
+		}
 
-	D(("starting the timer"));
+		/* Keep only as many read requests for ARP packets in
+		 * circulation as needed, and add more read requests for
+		 * IP packets if the network device is missing frames.
+		 */
+		for(ts = (struct tftp_session *)session_list.mlh_Head ;
+		    ts->ts_MinNode.mln_Succ != NULL ;
+		    ts = (struct tftp_session *)ts->ts_MinNode.mln_Succ)
+		{
+			if(ts->ts_state == tftp_state_request_ethernet_address)
+				break;
+		}
 
-	start_time(1);
+		set_num_arp_read_requests((ts->ts_MinNode.mln_Succ != NULL) ? NUM_ARP_READ_REQUESTS : MIN_ARP_READ_REQUESTS);
 
-	time_signal_mask	= (1UL << time_port->mp_SigBit);
-	net_signal_mask		= (1UL << net_read_port->mp_SigBit);
+		check_read_requests(&args);
 
-	signal_mask = SIGBREAKF_CTRL_C | time_signal_mask | net_signal_mask;
-	signals_received = 0;
+		/* The timer must go off when the next transfer needs attention. */
+		schedule_session_timer();
 
-	while(TRUE)
-	{
 		/* Wait for something to happen... */
 		if(signals_received == 0)
 			signals_received = Wait(signal_mask);
@@ -615,9 +3707,25 @@ main(int argc,char ** argv)
 		else
 			signals_received |= (SetSignal(0,signal_mask) & signal_mask);
 
-		/* Stop the program? */
+		/* Stop the program? This ends all the transfers in progress. */
 		if(signals_received & SIGBREAKF_CTRL_C)
-			break;
+		{
+			stop_transfers = TRUE;
+
+			for(ts = (struct tftp_session *)session_list.mlh_Head ;
+			    ts->ts_MinNode.mln_Succ != NULL ;
+			    ts = (struct tftp_session *)ts->ts_MinNode.mln_Succ)
+			{
+				if(ts->ts_state != tftp_state_finished)
+				{
+					ts->ts_result = RETURN_WARN;
+					ts->ts_state = tftp_state_finished;
+				}
+			}
+
+			signals_received &= ~SIGBREAKF_CTRL_C;
+			continue;
+		}
 
 		/* New network data has arrived? */
 		if(signals_received & net_signal_mask)
@@ -646,7 +3754,7 @@ main(int argc,char ** argv)
 
 						D(("TESTING: Dropping received %s packet.", type));
 
-						send_net_io_read_request(read_request,read_request->nior_Type);
+						restart_net_io_read_request(read_request);
 						read_request = NULL;
 					}
 					else if (0 < trash_rx && (rand() % 100) < trash_rx)
@@ -660,6 +3768,9 @@ main(int argc,char ** argv)
 							ASSERT( read_request->nior_IOS2.ios2_DataLength <= read_request->nior_BufferSize );
 
 							((UBYTE *)read_request->nior_Buffer)[rand() % read_request->nior_IOS2.ios2_DataLength] ^= 0x81;
+
+							/* The checksum was calculated before the damage was done. */
+							read_request->nior_PayloadSumValid = FALSE;
 						}
 					}
 				}
@@ -677,8 +3788,15 @@ main(int argc,char ** argv)
 
 					SHOWMSG("received an IP datagram");
 
+					/* Drop anything which is not for us before
+					 * spending time on the checksums.
+					 */
+					if(NOT classify_ip_datagram(&args,read_request))
+					{
+						SHOWMSG("not for us");
+					}
 					/* Verify that the IP header checksum is correct. */
-					if(read_request->nior_IOS2.ios2_DataLength >= sizeof(*ip) && in_cksum(ip,sizeof(*ip)) == 0)
+					else if (in_cksum(ip,sizeof(*ip)) == 0)
 					{
 						/* This should be an IPv4 datagram, and it should contain
 						 * an UDP datagram.
@@ -691,483 +3809,63 @@ main(int argc,char ** argv)
 							SHOWMSG("datagram contains UDP data");
 
 							/* Is the UDP datagram checksum OK, and the datagram is
-							 * intended for our use? Furthermore, are we even ready to
-							 * process it yet?
+							 * intended for one of the transfers in progress? The
+							 * destination port number tells which one it is.
+							 * Furthermore, is that transfer even ready to process
+							 * it yet?
 							 */
-							checksum = verify_udp_datagram_checksum(ip);
-
-							if(checksum == 0 &&
-							   udp->uh_dport == client_udp_port_number &&
-							   (!server_udp_port_number_known || udp->uh_sport == server_udp_port_number) &&
-							   tftp_state > tftp_state_request_ethernet_address)
+							checksum = verify_udp_datagram_checksum(ip,read_request);
+							if(checksum == 0)
 							{
-								const struct tftphdr * tftp = (struct tftphdr *)&udp[1];
-								int length = udp->uh_ulen - sizeof(*udp);
-
-								/* Server responded with an error? We print the error message and abort. */
-								if (tftp->th_opcode == TFTP_PACKET_ERROR)
-								{
-									const char * error_text;
-									char number[20];
-									char message_buffer[SEGSIZE+1];
-									int message_length;
-
-									SHOWMSG("TFTP opcode = TFTP_PACKET_ERROR");
+								ts = find_session(udp->uh_dport);
 
-									error_text = get_tftp_error_text(tftp->th_code);
-									if(error_text == NULL)
-									{
-										sprintf(number,"error %d",tftp->th_code);
-										error_text = number;
-									}
-
-									message_length = length - offsetof(struct tftphdr, th_msg);
-
-									ASSERT( message_length >= 0 );
-									ASSERT( message_length < (int)sizeof(message_buffer) );
-
-									memmove(message_buffer,tftp->th_msg,message_length);
-									message_buffer[message_length] = '\0';
-
-									if(!args.Quiet)
-										FPrintf(error_output, "%s: Server responded with error '%s', \"%s\".\n","TFTPClient",error_text,message_buffer);
-
-									D(("Server responded with error '%s', '%s'.",error_text,message_buffer));
-
-									result = RETURN_ERROR;
-									goto out;
-								}
-								/* Server has transmitted data? */
-								else if (tftp->th_opcode == TFTP_PACKET_DATA)
-								{
-									int payload_length = length - offsetof(struct tftphdr, th_data);
-
-									SHOWMSG("TFTP opcode = TFTP_PACKET_DATA");
-
-									/* Make sure that the data packet size is sane. */
-									if(payload_length > SEGSIZE)
-									{
-										if(args.Verbose)
-										{
-											Printf("Data packet size (%ld bytes) is larger than expected; keeping only the first %ld bytes.\n",
-												payload_length, SEGSIZE);
-										}
-										
-										D(("Data packet size (%ld bytes) is larger than expected; keeping only the first %ld bytes.",payload_length, SEGSIZE));
-
-										payload_length = SEGSIZE;
-									}
-
-									/* Did we just request to start reception of data? */
-									if (tftp_state == tftp_state_request_read)
-									{
-										/* This should be the very first data block. */
-										if(tftp->th_block == 1)
-										{
-											/* This is important: the server's tftp session is bound
-											 * to a specific port number now.
-											 */
-											server_udp_port_number = udp->uh_sport;
-											server_udp_port_number_known = TRUE;
-
-											if(args.Verbose)
-												Printf("Server has acknowledged the read request (using UDP port number %ld).\n", server_udp_port_number);
-
-											D(("Server has acknowledged the read request (using UDP port number %ld).", server_udp_port_number));
-
-											/* Store the data, if any. */
-											if(payload_length > 0)
-											{
-												if(args.Verbose)
-													Printf("Writing block #%ld (%ld bytes).\n",tftp->th_block,payload_length);
-
-												D(("Writing block #%ld (%ld bytes).",tftp->th_block,payload_length));
-
-												SetIoErr(0);
-
-												if(FWrite(destination_file,(APTR)tftp->th_data,payload_length,1) == 0)
-												{
-													TEXT error_message[256];
-
-													Fault(IoErr(),NULL,error_message,sizeof(error_message));
-
-													if(!args.Quiet)
-														FPrintf(error_output, "%s: Error writing to file \"%s\" (%s).\n","TFTPClient",to_path,error_message);
-
-													D(("Error writing to file '%s' (%s).",to_path,error_message));
-
-													send_tftp_error(TFTP_ERROR_UNDEF,"Error writing to file",client_udp_port_number,server_udp_port_number,tftp_packet);
-
-													result = RETURN_ERROR;
-													goto out;
-												}
-
-												total_num_bytes_transferred += payload_length;
-
-												/* We received some data to keep, so do not delete the file. */
-												delete_destination_file = FALSE;
-											}
-											else
-											{
-												SHOWMSG("no data in the packet");
-											}
-
-											/* Is this the last data to be received? */
-											if(payload_length < SEGSIZE)
-											{
-												SHOWMSG("this is the last block transmitted by the server");
-
-												last_block_transmitted = TRUE;
-												num_eof_acknowledgements--;
-											}
-
-											tftp_state = tftp_state_write_to_file;
-
-											block_number = 2;
-
-											if(args.Verbose)
-												Printf("Acknowledging receipt of block #%ld.\n",block_number-1);
-
-											D(("Acknowledging receipt of block #%ld.",block_number-1));
-
-											send_tftp_acknowledgement(block_number-1,client_udp_port_number,server_udp_port_number,tftp_packet);
-
-											/* Restart the timer; make sure that we won't try to
-											 * service the returning time request or there will
-											 * be trouble.
-											 */
-											signals_received &= ~time_signal_mask;
-
-											D(("starting the timer"));
-
-											start_time(1);
-										}
-										else
-										{
-											if(args.Verbose)
-												Printf("Ignoring receipt of block #%ld.\n",tftp->th_block);
-											
-											D(("Ignoring receipt of block #%ld.",tftp->th_block));
-										}
-									}
-									/* Are we already receiving data to be written? */
-									else if (tftp_state == tftp_state_write_to_file)
-									{
-										/* Is this the next block we expected? */
-										if(tftp->th_block == block_number)
-										{
-											/* Store the data, if any. */
-											if(payload_length > 0)
-											{
-												if(args.Verbose)
-													Printf("Writing block #%ld (%ld bytes).\n",tftp->th_block,payload_length);
-
-												D(("Writing block #%ld (%ld bytes).",tftp->th_block,payload_length));
-
-												SetIoErr(0);
-
-												if(FWrite(destination_file,(APTR)tftp->th_data,payload_length,1) == 0)
-												{
-													TEXT error_message[256];
-
-													Fault(IoErr(),NULL,error_message,sizeof(error_message));
-
-													if(!args.Quiet)
-														FPrintf(error_output, "%s: Error writing to file \"%s\" (%s).\n","TFTPClient",to_path,error_message);
-													
-													D(("Error writing to file '%s' (%s).",to_path,error_message));
-
-													send_tftp_error(TFTP_ERROR_UNDEF,"Error writing to file",client_udp_port_number,server_udp_port_number,tftp_packet);
-
-													result = RETURN_ERROR;
-													goto out;
-												}
-
-												total_num_bytes_transferred += payload_length;
-
-												/* We received some data to keep, do not delete the file. */
-												delete_destination_file = FALSE;
-											}
-
-											/* Is this the last data to be received? */
-											if(payload_length < SEGSIZE)
-											{
-												last_block_transmitted = TRUE;
-												num_eof_acknowledgements--;
-											}
-
-											block_number++;
-
-											if(args.Verbose)
-												Printf("Acknowledging receipt of block #%ld.\n",block_number-1);
-											
-											D(("Acknowledging receipt of block #%ld.",block_number-1));
-
-											send_tftp_acknowledgement(block_number-1,client_udp_port_number,server_udp_port_number,tftp_packet);
-
-											/* Restart the timer; make sure that we won't try to
-											 * service the returning time request or there will
-											 * be trouble.
-											 */
-											signals_received &= ~time_signal_mask;
-
-											D(("starting the timer"));
-
-											start_time(1);
-										}
-										/* No, this is the wrong block. */
-										else
-										{
-											if(args.Verbose)
-												Printf("Ignoring receipt of block #%ld; was expecting block #%ld instead.\n",tftp->th_block,block_number);
-											
-											D(("Ignoring receipt of block #%ld; was expecting block #%ld instead.",tftp->th_block,block_number));
-										}
-									}
-									else
-									{
-										if(args.Verbose)
-											Printf("Ignoring receipt of unexpected data block #%ld.\n",tftp->th_block);
-										
-										D(("Ignoring receipt of unexpected data block #%ld.",tftp->th_block));
-									}
-								}
-								/* Server has acknowledged reception of data, or of the write request? */
-								else if (tftp->th_opcode == TFTP_PACKET_ACK)
-								{
-									SHOWMSG("TFTP opcode = TFTP_PACKET_ACK");
-
-									/* Could this be the server response to the write request? */
-									if (tftp_state == tftp_state_request_write)
-									{
-										/* The acknowledgement comes in the form of block #0 only. */
-										if(tftp->th_block == 0)
-										{
-											LONG num_bytes_read;
-
-											/* This is important: the server's tftp session is bound
-											 * to a specific port number now.
-											 */
-											server_udp_port_number = udp->uh_sport;
-											server_udp_port_number_known = TRUE;
-
-											if(args.Verbose)
-												Printf("Server has acknowledged the write request (using UDP port number %ld).\n", server_udp_port_number);
-											
-											D(("Server has acknowledged the write request (using UDP port number %ld).", server_udp_port_number));
-
-											tftp_state = tftp_state_read_from_file;
-
-											block_number = 1;
-
-											if(args.Verbose)
-												Printf("Reading block #%ld.\n",block_number);
-											
-											D(("Reading block #%ld.",block_number));
-
-											SetIoErr(0);
-
-											num_bytes_read = FRead(source_file,tftp_output->th_data,1,SEGSIZE);
-											if(num_bytes_read == 0 && IoErr() != 0)
-											{
-												TEXT error_message[256];
-
-												Fault(IoErr(),NULL,error_message,sizeof(error_message));
-
-												if(!args.Quiet)
-													FPrintf(error_output, "%s: Error reading from file \"%s\" (%s).\n","TFTPClient",from_path,error_message);
-												
-												D(("Error reading from file '%s' (%s).",from_path,error_message));
-
-												send_tftp_error(TFTP_ERROR_UNDEF,"Error reading from file",client_udp_port_number,server_udp_port_number,tftp_packet);
-
-												result = RETURN_ERROR;
-												goto out;
-											}
-
-											total_num_bytes_transferred += num_bytes_read;
-
-											/* Did we just read the last data to be transmitted? */
-											if(num_bytes_read < SEGSIZE)
-											{
-												last_block_transmitted = TRUE;
-
-												if(args.Verbose)
-													Printf("This is the last block to be read.\n");
-												
-												D(("This is the last block to be read."));
-											}
-
-											tftp_output->th_opcode	= TFTP_PACKET_DATA;
-											tftp_output->th_block	= block_number;
-
-											tftp_output_length = offsetof(struct tftphdr, th_data) + num_bytes_read;
-											tftp_payload_length = num_bytes_read;
-
-											if(args.Verbose)
-												Printf("Sending block #%ld (%ld bytes).\n",block_number,tftp_payload_length);
-											
-											D(("Sending block #%ld (%ld bytes).",block_number,tftp_payload_length));
-
-											send_udp(client_udp_port_number,server_udp_port_number,tftp_output,tftp_output_length);
-
-											/* Restart the timer; make sure that we won't try to
-											 * service the returning time request or there will
-											 * be trouble.
-											 */
-											signals_received &= ~time_signal_mask;
-
-											D(("starting the timer"));
-
-											start_time(1);
-										}
-										else
-										{
-											if(args.Verbose)
-												Printf("Ignoring receipt of acknowledgement for block #%ld.\n",tftp->th_block);
-											
-											D(("Ignoring receipt of acknowledgement for block #%ld.",tftp->th_block));
-										}
-									}
-									/* Could this be the response to the block we just sent to the server? */
-									else if (tftp_state == tftp_state_read_from_file)
-									{
-										/* Is this really the acknowledgement for the block just sent? */
-										if(tftp->th_block == block_number)
-										{
-											LONG num_bytes_read;
-
-											/* Are we finished now? */
-											if(last_block_transmitted)
-											{
-												if(args.Verbose)
-													Printf("Transmission completed.\n");
-												
-												D(("Transmission completed."));
-
-												break;
-											}
-
-											block_number++;
-
-											if(args.Verbose)
-											{
-												Printf("Server has acknowledged receipt of block #%ld.\n", block_number-1);
-												Printf("Reading block #%ld.\n",block_number);
-											}
-
-											D(("Server has acknowledged receipt of block #%ld.", block_number-1));
-											D(("Reading block #%ld.",block_number));
-
-											SetIoErr(0);
-
-											num_bytes_read = FRead(source_file,tftp_output->th_data,1,SEGSIZE);
-											if(num_bytes_read == 0 && IoErr() != 0)
-											{
-												TEXT error_message[256];
-
-												Fault(IoErr(),NULL,error_message,sizeof(error_message));
-
-												if(!args.Quiet)
-													FPrintf(error_output, "%s: Error reading from file \"%s\" (%s).\n","TFTPClient",from_path,error_message);
-												
-												D(("Error reading from file '%s' (%s).",from_path,error_message));
-
-												send_tftp_error(TFTP_ERROR_UNDEF,"Error reading from file",client_udp_port_number,server_udp_port_number,tftp_packet);
-
-												result = RETURN_ERROR;
-												goto out;
-											}
-
-											total_num_bytes_transferred += num_bytes_read;
-
-											/* Did we just read the last data to be transmitted?
-											 * We also check for block number overflows, which
-											 * limits the number of blocks we can safely transmit.
-											 */
-											if(num_bytes_read < SEGSIZE || ((block_number + 1) & 0xffff) == 0)
-											{
-												last_block_transmitted = TRUE;
-
-												if(args.Verbose)
-													Printf("This is the last block to be read.\n");
-												
-												D(("This is the last block to be read."));
-											}
-
-											tftp_output->th_opcode	= TFTP_PACKET_DATA;
-											tftp_output->th_block	= block_number;
-
-											tftp_output_length = offsetof(struct tftphdr, th_data) + num_bytes_read;
-											tftp_payload_length = num_bytes_read;
-
-											if(args.Verbose)
-												Printf("Sending block #%ld (%ld bytes).\n",block_number,tftp_payload_length);
-											
-											D(("Sending block #%ld (%ld bytes).",block_number,tftp_payload_length));
-
-											send_udp(client_udp_port_number,server_udp_port_number,tftp_output,tftp_output_length);
-
-											/* Restart the timer; make sure that we won't try to
-											 * service the returning time request or there will
-											 * be trouble.
-											 */
-											signals_received &= ~time_signal_mask;
-
-											D(("starting the timer"));
-
-											start_time(1);
-										}
-										else
-										{
-											if(args.Verbose)
-												Printf("Ignoring receipt of acknowledgement for block #%ld; was expecting block #%ld instead.\n",tftp->th_block,block_number);
-											
-											D(("Ignoring receipt of acknowledgement for block #%ld; was expecting block #%ld instead.",tftp->th_block,block_number));
-										}
-									}
-									else
-									{
-										if(args.Verbose)
-											Printf("Ignoring receipt of acknowledgement for block #%ld.\n",tftp->th_block);
-										
-										D(("Ignoring receipt of acknowledgement for block #%ld.",tftp->th_block));
-									}
-								}
-								/* This is an unsupported TFTP operation. We report the problem and then quit. */
-								else
-								{
-									if(!args.Quiet)
-										FPrintf(error_output, "%s: Received unsupported TFTP operation %ld -- aborting.\n","TFTPClient",tftp->th_opcode);
-									
-									D(("Received unsupported TFTP operation %ld -- aborting.",tftp->th_opcode));
-
-									send_tftp_error(TFTP_ERROR_BADOP,"Huh?",client_udp_port_number,server_udp_port_number,tftp_packet);
+								/* The data blocks may also have been sent to a
+								 * multicast group which one of the transfers
+								 * has joined.
+								 */
+								if(ts == NULL && (ip->ip_dst & 0xF0000000UL) == 0xE0000000UL)
+									ts = find_multicast_session(ip->ip_dst,udp->uh_dport);
+							}
+							else
+							{
+								ts = NULL;
+							}
 
-									result = RETURN_ERROR;
-									goto out;
-								}
+							/* Is this a request for the server to send or receive a file? */
+							if(checksum == 0 && args.Server && udp->uh_dport == default_server_udp_port_number)
+							{
+								if(accept_server_request(error_output,&args,ip,udp,read_request->nior_IOS2.ios2_SrcAddr,num_sessions) != NULL)
+									num_sessions++;
+							}
+							else if (ts != NULL &&
+							         (!ts->ts_server_udp_port_number_known || udp->uh_sport == ts->ts_server_udp_port_number) &&
+							         ts->ts_state > tftp_state_request_ethernet_address)
+							{
+								handle_session_datagram(error_output,&args,ts,udp);
 							}
 							else
 							{
+								if (checksum != 0)
+									num_ip_datagrams_rejected[ip_rejected_udp_checksum]++;
+
 								if(args.Verbose)
 								{
 									if (checksum != 0)
 										Printf("Ignoring UDP datagram with incorrect checksum.\n");
-									else if (udp->uh_dport != client_udp_port_number)
-										Printf("Ignoring UDP datagram sent to port %ld; expected port %ld.\n", udp->uh_dport, client_udp_port_number);
-									else if (server_udp_port_number_known && udp->uh_sport != server_udp_port_number)
-										Printf("Ignoring UDP datagram sent by server from port %ld; expected port %ld.\n", udp->uh_sport, server_udp_port_number);
+									else if (ts == NULL)
+										Printf("Ignoring UDP datagram sent to port %ld.\n", udp->uh_dport);
+									else if (ts->ts_server_udp_port_number_known && udp->uh_sport != ts->ts_server_udp_port_number)
+										Printf("Ignoring UDP datagram sent by server from port %ld; expected port %ld.\n", udp->uh_sport, ts->ts_server_udp_port_number);
 									else
 										Printf("Ignoring UDP datagram.\n");
 								}
 
 								if (checksum != 0)
 									D(("Ignoring UDP datagram with incorrect checksum."));
-								else if (udp->uh_dport != client_udp_port_number)
-									D(("Ignoring UDP datagram sent to port %ld; expected port %ld.", udp->uh_dport, client_udp_port_number));
-								else if (server_udp_port_number_known && udp->uh_sport != server_udp_port_number)
-									D(("Ignoring UDP datagram sent by server from port %ld; expected port %ld.", udp->uh_sport, server_udp_port_number));
+								else if (ts == NULL)
+									D(("Ignoring UDP datagram sent to port %ld.", udp->uh_dport));
+								else if (ts->ts_server_udp_port_number_known && udp->uh_sport != ts->ts_server_udp_port_number)
+									D(("Ignoring UDP datagram sent by server from port %ld; expected port %ld.", udp->uh_sport, ts->ts_server_udp_port_number));
 								else
 									D(("Ignoring UDP datagram."));
 							}
@@ -1182,6 +3880,22 @@ main(int argc,char ** argv)
 							/* The ICMP header and message data checksum should be correct. */
 							if(in_cksum(&ip[1],ip->ip_len - sizeof(*ip)) == 0)
 							{
+								const struct icmp_unreachable_header * unreachable = (struct icmp_unreachable_header *)icmp_header;
+								const struct udphdr * undelivered_udp = (struct udphdr *)&unreachable[1];
+
+								/* The "unreachable" error quotes the headers of the
+								 * datagram which could not be delivered, and its
+								 * source port number tells which transfer is affected.
+								 */
+								ts = NULL;
+
+								if(icmp_header->type == icmp_type_unreach &&
+								   ip->ip_len >= sizeof(*ip) + sizeof(*unreachable) + sizeof(*undelivered_udp) &&
+								   unreachable->ip.ip_pr == IPPROTO_UDP)
+								{
+									ts = find_session(undelivered_udp->uh_sport);
+								}
+
 								/* We print more detailed information for the
 								 * "unreachable" error, but only if we didn't
 								 * already finish transmitting data. Some TFTP
@@ -1189,103 +3903,25 @@ main(int argc,char ** argv)
 								 * has been transmitted, which produces a
 								 * "destination unreachable: bad port" error.
 								 */
-								if(icmp_header->type == icmp_type_unreach && NOT last_block_transmitted)
+								if(ts != NULL && NOT ts->ts_last_block_transmitted)
 								{
-									const struct icmp_unreachable_header * unreachable = (struct icmp_unreachable_header *)icmp_header;
-									const char * type;
-									char number[20];
-
-									switch(unreachable->header.code)
-									{
-										case icmp_code_unreach_net:
-
-											type = "bad network";
-											break;
-
-										case icmp_code_unreach_host:
-
-											type = "bad host";
-											break;
-
-										case icmp_code_unreach_protocol:
-
-											type = "bad protocol";
-											break;
-
-										case icmp_code_unreach_port:
-
-											type = "bad port";
-											break;
-
-										case icmp_code_unreach_needfrag:
-
-											type = "packet dropped due to fragmentation";
-											break;
-
-										case icmp_code_unreach_srcfail:
-
-											type = "source route failed";
-											break;
-
-										case icmp_code_unreach_net_unknown:
-
-											type = "unknown network";
-											break;
-
-										case icmp_code_unreach_host_unknown:
-
-											type = "unknown host";
-											break;
-
-										case icmp_code_unreach_isolated:
-
-											type = "source host isolated";
-											break;
-
-										case icmp_code_unreach_net_prohib:
-										case icmp_code_unreach_host_prohib:
-
-											type = "prohibited access";
-											break;
-
-										case icmp_code_unreach_tosnet:
-
-											type = "bad TOS for network";
-											break;
-
-										case icmp_code_unreach_toshost:
-
-											type = "bad TOS for host";
-											break;
-
-										default:
-
-											sprintf(number,"%d",unreachable->header.code);
-											type = number;
-											break;
-									}
-
-									if(args.Verbose)
-										FPrintf(error_output,"%s: Destination unreachable (%s) -- aborting.\n", "TFTPClient", type);
-									
-									D(("Destination unreachable (%s) -- aborting.", type));
-
-									result = RETURN_ERROR;
-									goto out;
+									handle_session_unreachable(error_output,&args,ts,unreachable->header.code);
 								}
 								else
 								{
 									if(args.Verbose)
 										Printf("Ignoring ICMP datagram with code=%ld and type=%ld.\n", icmp_header->type, icmp_header->code);
-									
+
 									D(("Ignoring ICMP datagram with code=%ld and type=%ld.", icmp_header->type, icmp_header->code));
 								}
 							}
 							else
 							{
+								num_ip_datagrams_rejected[ip_rejected_icmp_checksum]++;
+
 								if(args.Verbose)
 									Printf("Ignoring ICMP datagram with incorrect checksum.\n");
-								
+
 								D(("Ignoring ICMP datagram with incorrect checksum."));
 							}
 						}
@@ -1303,6 +3939,8 @@ main(int argc,char ** argv)
 					}
 					else
 					{
+						num_ip_datagrams_rejected[ip_rejected_header_checksum]++;
+
 						if(args.Verbose)
 							Printf("Ignoring IP datagram with incorrect checksum.\n");
 						
@@ -1353,48 +3991,47 @@ main(int argc,char ** argv)
 						 */
 						else if (ahe->ahe_Operation == ARPOP_REPLY)
 						{
-							if(ahe->ahe_SenderProtocolAddress == remote_ipv4_address)
-							{
-								if(args.Verbose)
-									Printf("Received ARP response.\n");
-								
-								D(("Received ARP response."));
+							BOOL expected = FALSE;
 
-								/* Update the remote TFTP server Ethernet MAC address. */
-								memmove(remote_ethernet_address,ahe->ahe_SenderHardwareAddress,sizeof(remote_ethernet_address));
+							/* Several transfers may be waiting for the Ethernet MAC
+							 * address of the same server.
+							 */
+							for(ts = (struct tftp_session *)session_list.mlh_Head ;
+							    ts->ts_MinNode.mln_Succ != NULL ;
+							    ts = (struct tftp_session *)ts->ts_MinNode.mln_Succ)
+							{
+								if(ts->ts_state == tftp_state_finished || ahe->ahe_SenderProtocolAddress != ts->ts_remote_ipv4_address)
+									continue;
 
-								/* If we are still waiting for the Ethernet MAC address of
-								 * the remote server to become available, begin the TFTP
-								 * exchange.
-								 */
-								if(tftp_state == tftp_state_request_ethernet_address)
+								if(NOT expected)
 								{
 									if(args.Verbose)
-										Printf("Trying to begin transmission of file \"%s\".\n", local_filename);
-									
-									D(("Trying to begin transmission of file '%s'.", local_filename));
-									
-									tftp_state = (from_ipv4_address == 0) ? tftp_state_request_write : tftp_state_request_read;
-
-									start_tftp(tftp_state == tftp_state_request_write ? TFTP_PACKET_WRQ : TFTP_PACKET_RRQ,
-										remote_filename,client_udp_port_number,server_udp_port_number,tftp_packet);
+										Printf("Received ARP response.\n");
 
-									/* Restart the timer; make sure that we won't try to
-									 * service the returning time request or there will
-									 * be trouble.
-									 */
-									signals_received &= ~time_signal_mask;
+									D(("Received ARP response."));
 
-									D(("starting the timer"));
+									/* Remember it for the next file to be transferred. */
+									update_arp_cache(ahe->ahe_SenderProtocolAddress,ahe->ahe_SenderHardwareAddress);
 
-									start_time(1);
+									expected = TRUE;
 								}
+
+								/* Update the remote TFTP server Ethernet MAC address. */
+								memmove(ts->ts_remote_ethernet_address,ahe->ahe_SenderHardwareAddress,sizeof(ahe->ahe_SenderHardwareAddress));
+
+								/* If we are still waiting for the Ethernet MAC address of
+								 * the remote server to become available, begin the TFTP
+								 * exchange.
+								 */
+								if(ts->ts_state == tftp_state_request_ethernet_address)
+									begin_session_request(&args,ts);
 							}
-							else
+
+							if(NOT expected)
 							{
 								if(args.Verbose)
 									Printf("Ignoring ARP response; it's not for us.\n");
-								
+
 								D(("Ignoring ARP response; it's not for us."));
 							}
 						}
@@ -1417,7 +4054,7 @@ main(int argc,char ** argv)
 
 				/* Put the read request back into circulation. */
 				D(("restarting read request 0x%08lx", read_request));
-				send_net_io_read_request(read_request,read_request->nior_Type);
+				restart_net_io_read_request(read_request);
 			}
 			else
 			{
@@ -1426,140 +4063,161 @@ main(int argc,char ** argv)
 			}
 		}
 
-		/* A timeout has elapsed? */
-		if(signals_received & time_signal_mask)
+		/* The network driver has sent some of the datagrams? */
+		if(signals_received & net_write_signal_mask)
 		{
-			if(time_in_use)
-				WaitIO((struct IORequest *)time_request);
-				
-			time_in_use = FALSE;
-
-			/* No response to the ARP request has arrived yet? */
-			if (tftp_state == tftp_state_request_ethernet_address)
-			{
-				if(num_arp_resolution_attempts == 0)
-				{
-					if(args.Verbose)
-						FPrintf(error_output, "%s: No response to ARP query received -- aborting.\n","TFTPClient");
-					
-					D(("No response to ARP query received -- aborting."));
+			handle_write_replies();
 
-					result = RETURN_ERROR;
-					goto out;
-				}
+			signals_received &= ~net_write_signal_mask;
+		}
 
-				if(args.Verbose)
-					Printf("Repeating ARP query...\n");
-				
-				D(("Repeating ARP query."));
+		/* Some of the datagrams could not be sent? */
+		handle_transmit_errors(error_output,&args);
 
-				broadcast_arp_query(remote_ipv4_address);
+		/* The disk writer process has written some of the data? */
+		if(signals_received & disk_write_signal_mask)
+		{
+			handle_disk_write_replies(error_output,&args);
 
-				num_arp_resolution_attempts--;
+			signals_received &= ~disk_write_signal_mask;
+		}
 
-				D(("starting the timer"));
+		/* A timeout has elapsed? */
+		if(signals_received & time_signal_mask)
+		{
+			/* The timer may have been restarted since it went off,
+			 * in which case it is still busy.
+			 */
+			if(time_in_use && CheckIO((struct IORequest *)time_request) != NULL)
+			{
+				WaitIO((struct IORequest *)time_request);
 
-				start_time(1);
+				time_in_use = FALSE;
 			}
-			/* The server has not replied to our write/read request yet? */
-			else if (tftp_state == tftp_state_request_write || tftp_state == tftp_state_request_read)
-			{
-				if(args.Verbose)
-					Printf("Trying to begin transmission of file \"%s\" again.\n", local_filename);
-				
-				D(("Trying to begin transmission of file '%s' again.", local_filename));
-				
-				start_tftp(tftp_state == tftp_state_request_write ? TFTP_PACKET_WRQ : TFTP_PACKET_RRQ,
-					remote_filename,client_udp_port_number,server_udp_port_number,tftp_packet);
 
-				D(("starting the timer"));
+			now = get_milliseconds();
 
-				start_time(1);
-			}
-			/* The server has not yet acknowledged the receipt of the block we sent to it? */
-			else if (tftp_state == tftp_state_read_from_file)
+			for(ts = (struct tftp_session *)session_list.mlh_Head ;
+			    ts->ts_MinNode.mln_Succ != NULL ;
+			    ts = (struct tftp_session *)ts->ts_MinNode.mln_Succ)
 			{
-				if(args.Verbose)
-					Printf("Sending block #%ld again (%ld bytes).\n",block_number,tftp_payload_length);
-				
-				D(("Sending block #%ld again (%ld bytes).",block_number,tftp_payload_length));
+				if(ts->ts_state != tftp_state_finished && (LONG)(now - ts->ts_deadline) >= 0)
+					handle_session_timeout(error_output,&args,ts);
+			}
 
-				send_udp(client_udp_port_number,server_udp_port_number,tftp_output,tftp_output_length);
+			signals_received &= ~time_signal_mask;
+		}
 
-				D(("starting the timer"));
+		/* Read the next blocks from the files, as many as the
+		 * windows will hold, and send them to the servers?
+		 */
+		for(ts = (struct tftp_session *)session_list.mlh_Head ;
+		    ts->ts_MinNode.mln_Succ != NULL ;
+		    ts = (struct tftp_session *)ts->ts_MinNode.mln_Succ)
+		{
+			if(ts->ts_state != tftp_state_finished && ts->ts_send_window)
+				send_session_window(error_output,&args,ts);
+		}
+	}
 
-				start_time(1);
-			}
-			/* The server has not yet sent the next block to write? */
-			else if (tftp_state == tftp_state_write_to_file)
-			{
-				if(last_block_transmitted)
-				{
-					num_eof_acknowledgements--;
-					if(num_eof_acknowledgements == 0)
-					{
-						if(args.Verbose)
-							Printf("Transmission completed.\n");
-						
-						D(("Transmission completed."));
+	if(stop_transfers)
+	{
+		if(!args.Quiet)
+			PrintFault(ERROR_BREAK,"TFTPClient");
+	}
 
-						break;
-					}
-				}
+	if((num_transfers > 1 || args.Server) && !args.Quiet)
+	{
+		Printf("%ld of %ld files transferred (%s bytes in total).\n",num_transfers_completed,num_transfers,
+			convert_quad_to_string(&total_num_bytes_transferred,num_bytes_text));
+	}
 
-				if(args.Verbose)
-					Printf("Acknowledging receipt of block #%ld again.\n",block_number-1);
-				
-				D(("Acknowledging receipt of block #%ld again.",block_number-1));
+	/* How much data had to be copied into the transmission buffer,
+	 * besides the IP and UDP headers?
+	 */
+	if(num_udp_datagrams_sent > 0)
+	{
+		if(args.Verbose)
+		{
+			Printf("%lu UDP datagrams sent, %lu bytes copied into the transmission buffer (%lu bytes per datagram).\n",
+				num_udp_datagrams_sent,num_udp_bytes_copied,num_udp_bytes_copied / num_udp_datagrams_sent);
+		}
 
-				send_tftp_acknowledgement(block_number-1,client_udp_port_number,server_udp_port_number,tftp_packet);
+		D(("%lu UDP datagrams sent, %lu bytes copied into the transmission buffer (%lu bytes per datagram).",
+			num_udp_datagrams_sent,num_udp_bytes_copied,num_udp_bytes_copied / num_udp_datagrams_sent));
 
-				D(("starting the timer"));
+		if(args.Verbose)
+		{
+			Printf("At most %lu datagrams were being sent at the same time; %lu times the program had to wait (%lu ms in total). %lu datagrams could not be sent.\n",
+				max_num_write_requests_in_use,num_write_request_stalls,write_request_stall_time,num_transmit_errors);
+		}
 
-				start_time(1);
-			}
+		D(("At most %lu datagrams were being sent at the same time; %lu times the program had to wait (%lu ms in total). %lu datagrams could not be sent.",
+			max_num_write_requests_in_use,num_write_request_stalls,write_request_stall_time,num_transmit_errors));
+	}
 
-			signals_received &= ~time_signal_mask;
+	/* How did the network driver exchange data with the read and
+	 * write request buffers?
+	 */
+	show_buffer_management_statistics(&args);
+
+	/* How many IP datagrams were of no interest, and at which stage
+	 * were they rejected?
+	 */
+	if(num_ip_datagrams_received > 0)
+	{
+		if(args.Verbose)
+		{
+			Printf("%lu IP datagrams received; ignored %lu malformed, %lu for other addresses, %lu for other protocols, %lu for other ports, "
+				"%lu/%lu/%lu with bad IP/UDP/ICMP checksums.\n",
+				num_ip_datagrams_received,
+				num_ip_datagrams_rejected[ip_rejected_malformed],
+				num_ip_datagrams_rejected[ip_rejected_address],
+				num_ip_datagrams_rejected[ip_rejected_protocol],
+				num_ip_datagrams_rejected[ip_rejected_port],
+				num_ip_datagrams_rejected[ip_rejected_header_checksum],
+				num_ip_datagrams_rejected[ip_rejected_udp_checksum],
+				num_ip_datagrams_rejected[ip_rejected_icmp_checksum]);
 		}
+
+		D(("%lu IP datagrams received; ignored %lu malformed, %lu for other addresses, %lu for other protocols, %lu for other ports, "
+			"%lu/%lu/%lu with bad IP/UDP/ICMP checksums.",
+			num_ip_datagrams_received,
+			num_ip_datagrams_rejected[ip_rejected_malformed],
+			num_ip_datagrams_rejected[ip_rejected_address],
+			num_ip_datagrams_rejected[ip_rejected_protocol],
+			num_ip_datagrams_rejected[ip_rejected_port],
+			num_ip_datagrams_rejected[ip_rejected_header_checksum],
+			num_ip_datagrams_rejected[ip_rejected_udp_checksum],
+			num_ip_datagrams_rejected[ip_rejected_icmp_checksum]));
 	}
 
-	result = RETURN_OK;
+	/* How many read requests were needed, and did the network device
+	 * run out of them?
+	 */
+	if(args.Verbose)
+		Printf("%ld IP and %ld ARP read requests were in use; the network device missed %lu frames.\n",num_ip_read_requests,num_arp_read_requests,num_overruns);
+
+	D(("%ld IP and %ld ARP read requests were in use; the network device missed %lu frames.",num_ip_read_requests,num_arp_read_requests,num_overruns));
 
  out:
 
-	if(args.Verbose)
-		Printf("A total of %ld bytes were transmitted.\n",total_num_bytes_transferred);
-	
-	D(("A total of %ld bytes were transmitted.",total_num_bytes_transferred));
+	/* Close the files of the transfers which are still in progress. */
+	while((ts = (struct tftp_session *)RemHead((struct List *)&session_list)) != NULL)
+	{
+		if(disk_write_reply_port != NULL)
+			wait_for_session_writes(error_output,&args,ts);
+
+		end_session(&args,ts);
+		FreeVec(ts);
+	}
 
 	cleanup();
 
+	free_transfer_list(&transfer_list);
+
 	if(rda != NULL)
 		FreeArgs(rda);
 
-	if(source_file != (BPTR)NULL)
-		Close(source_file);
-
-	/* If a file was created to stored the received data
-	 * in, close it and perform some postprocessing
-	 * on it.
-	 */
-	if(destination_file != (BPTR)NULL)
-	{
-		Close(destination_file);
-
-		if(to_path != NULL)
-		{
-			/* Delete an incomplete file. */
-			if(delete_destination_file)
-				DeleteFile(to_path);
-			/* Keep the file, but mark it as not executable,
-			 * just to be safe.
-			 */
-			else
-				SetProtection(to_path, FIBF_EXECUTE);
-		}
-	}
-
 	return(result);
 }
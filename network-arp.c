@@ -58,6 +58,83 @@
 
 /****************************************************************************/
 
+/* The Ethernet addresses which were reported in response to our ARP
+ * queries, so that the same query need not be repeated for every file
+ * transferred. If the cache is full, the oldest entry is replaced.
+ */
+struct arp_cache_entry
+{
+	ULONG	ace_IPv4Address;
+	UBYTE	ace_EthernetAddress[6];
+};
+
+static struct arp_cache_entry arp_cache[ARP_CACHE_SIZE];
+static int num_arp_cache_entries;
+static int next_arp_cache_entry;
+
+/****************************************************************************/
+
+/* Look up the Ethernet address for an IPv4 address in the cache.
+ * Returns TRUE and fills in the Ethernet address if it was found.
+ */
+BOOL
+find_arp_cache_entry(ULONG ipv4_address,UBYTE * ethernet_address)
+{
+	BOOL found = FALSE;
+	int i;
+
+	ASSERT( ethernet_address != NULL );
+
+	for(i = 0 ; i < num_arp_cache_entries ; i++)
+	{
+		if(arp_cache[i].ace_IPv4Address == ipv4_address)
+		{
+			memmove(ethernet_address,arp_cache[i].ace_EthernetAddress,sizeof(arp_cache[i].ace_EthernetAddress));
+
+			found = TRUE;
+			break;
+		}
+	}
+
+	return(found);
+}
+
+/****************************************************************************/
+
+/* Remember the Ethernet address which belongs to an IPv4 address. */
+void
+update_arp_cache(ULONG ipv4_address,const UBYTE * ethernet_address)
+{
+	struct arp_cache_entry * ace = NULL;
+	int i;
+
+	ASSERT( ethernet_address != NULL );
+
+	for(i = 0 ; i < num_arp_cache_entries ; i++)
+	{
+		if(arp_cache[i].ace_IPv4Address == ipv4_address)
+		{
+			ace = &arp_cache[i];
+			break;
+		}
+	}
+
+	if(ace == NULL)
+	{
+		ace = &arp_cache[next_arp_cache_entry];
+
+		next_arp_cache_entry = (next_arp_cache_entry + 1) % ARP_CACHE_SIZE;
+
+		if(num_arp_cache_entries < ARP_CACHE_SIZE)
+			num_arp_cache_entries++;
+	}
+
+	ace->ace_IPv4Address = ipv4_address;
+	memmove(ace->ace_EthernetAddress,ethernet_address,sizeof(ace->ace_EthernetAddress));
+}
+
+/****************************************************************************/
+
 /* Send an ARP response message, which in this case means that we report which
  * combination of Ethernet address and IPv4 address this command uses. This sends
  * a single packet to the computer which broadcast an ARP request message.
@@ -128,9 +205,9 @@ send_arp_response(ULONG target_ipv4_address,const UBYTE * target_ethernet_addres
 	}
 	#endif /* TESTING */
 
-	ASSERT( NOT write_request->nior_InUse );
+	send_write_request();
 
-	error = DoIO((struct IORequest *)write_request);
+	error = OK;
 
 	RETURN(error);
 	return(error);
@@ -207,9 +284,9 @@ broadcast_arp_query(ULONG target_ipv4_address)
 	}
 	#endif /* TESTING */
 
-	ASSERT( NOT write_request->nior_InUse );
+	send_write_request();
 
-	error = DoIO((struct IORequest *)write_request);
+	error = OK;
 
 	RETURN(error);
 	return(error);
@@ -52,6 +52,14 @@
 #define	ARPOP_REQUEST	1	/* Request to resolve address */
 #define	ARPOP_REPLY		2	/* Response to previous request */
 
+/* How long to wait for a response to an ARP query, in milliseconds,
+ * before asking again.
+ */
+#define ARP_QUERY_TIMEOUT	1000
+
+/* How many IPv4 to Ethernet address mappings will be remembered. */
+#define ARP_CACHE_SIZE		16
+
 struct ARPHeaderEthernet
 {
 	UWORD	ahe_HardwareAddressFormat;		/* Should be 1 for Ethernet */
@@ -69,6 +77,8 @@ struct ARPHeaderEthernet
 
 extern LONG send_arp_response(ULONG target_ipv4_address,const UBYTE * target_ethernet_address);
 extern LONG broadcast_arp_query(ULONG target_ipv4_address);
+extern BOOL find_arp_cache_entry(ULONG ipv4_address,UBYTE * ethernet_address);
+extern void update_arp_cache(ULONG ipv4_address,const UBYTE * ethernet_address);
 
 /****************************************************************************/
 
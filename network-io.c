@@ -59,6 +59,7 @@
 #include "error-codes.h"
 #include "network-io.h"
 #include "testing.h"
+#include "timer.h"
 #include "args.h"
 
 /****************************************************************************/
@@ -76,15 +77,105 @@ BOOL net_io_list_initialized;
 /* Network read and write operations use different message ports. */
 static struct MsgPort * net_control_port;
 struct MsgPort * net_read_port;
+struct MsgPort * net_write_port;
 
 /****************************************************************************/
 
-/* The network driver is opened with the control request, and individual
- * write operations are performed only with the write request.
+/* The I/O requests and their buffers are carved out of a single block of
+ * memory, the arena. Each buffer begins at an address which is a multiple
+ * of NET_BUFFER_ALIGNMENT. The I/O requests which have been freed are kept
+ * for reuse.
+ */
+static APTR				net_arena;
+static UBYTE *			net_arena_start;
+static ULONG			net_arena_size;
+static ULONG			net_arena_used;
+static ULONG			net_arena_buffer_size;
+static struct MinList	spare_net_requests;
+
+/****************************************************************************/
+
+/* The network driver is opened with the control request. Write operations
+ * are performed with a pool of write requests, which are sent without
+ * waiting for the driver to finish. The write request is the one which is
+ * put together next, and which is always ready for use.
  */
 static struct NetIORequest * control_request;
 struct NetIORequest * write_request;
 
+static struct NetIORequest *	write_requests[MAX_WRITE_REQUESTS];
+static int						num_write_requests;
+
+/* How many write requests are currently being processed by the driver,
+ * how many were at most, how often and for how long in total
+ * (in milliseconds) the program had to wait for one to become
+ * available, and how many could not be sent.
+ */
+ULONG num_write_requests_in_use;
+ULONG max_num_write_requests_in_use;
+ULONG num_write_request_stalls;
+ULONG write_request_stall_time;
+ULONG num_transmit_errors;
+
+/* How many read requests for ARP and IP packets are in circulation,
+ * and how many ARP read requests there should be.
+ */
+int num_arp_read_requests;
+int num_ip_read_requests;
+static int wanted_num_arp_read_requests;
+
+/* The network device statistics, as last reported by the driver, when
+ * they were last checked, and how many read requests were put back into
+ * circulation since then. If the driver does not support the
+ * S2_GETGLOBALSTATS command, the statistics are not used.
+ */
+static BOOL						global_stats_supported;
+static struct Sana2DeviceStats	previous_global_stats;
+static ULONG					global_stats_time;
+static ULONG					num_read_requests_restarted;
+
+/* How many frames the network device missed in total, while the
+ * statistics were being watched.
+ */
+ULONG num_overruns;
+
+/* How often the network driver called each of the buffer management
+ * functions.
+ */
+enum buffer_management_t
+{
+	bm_copy_to_buff,
+	bm_copy_from_buff,
+	bm_copy_to_buff16,
+	bm_copy_from_buff16,
+	bm_copy_to_buff32,
+	bm_copy_from_buff32,
+	bm_dma_copy_to_buff32,
+	bm_dma_copy_to_buff32_refused,
+	bm_dma_copy_from_buff32,
+	bm_dma_copy_from_buff32_refused,
+	bm_dma_copy_to_buff64,
+	bm_dma_copy_to_buff64_refused,
+	bm_dma_copy_from_buff64,
+	bm_dma_copy_from_buff64_refused,
+
+	bm_num_functions
+};
+
+static ULONG buffer_management_counts[bm_num_functions];
+
+/* The errors reported for the write requests, which have yet to be
+ * picked up with get_transmit_error().
+ */
+static struct transmit_error	transmit_errors[MAX_TRANSMIT_ERRORS];
+static int						first_transmit_error;
+static int						num_pending_transmit_errors;
+
+/* Maximum transmission unit size supported by the network device, which
+ * determines how large the TFTP data blocks may become.
+ */
+ULONG net_mtu;
+
 /****************************************************************************/
 
 /* This data is used by the ARP requests. */
@@ -118,6 +209,7 @@ send_net_io_read_request(struct NetIORequest * nior,UWORD type)
 	nior->nior_IOS2.ios2_Req.io_Command	= CMD_READ;
 	nior->nior_IOS2.ios2_Data			= nior;
 	nior->nior_InUse					= TRUE;
+	nior->nior_PayloadSumValid			= FALSE;
 
 	SendIO((struct IORequest *)nior);
 
@@ -126,6 +218,164 @@ send_net_io_read_request(struct NetIORequest * nior,UWORD type)
 
 /****************************************************************************/
 
+/* Make a write request which the driver has finished with available for
+ * use again. If the datagram could not be sent, make a note of the error,
+ * to be picked up with get_transmit_error().
+ */
+static void
+reclaim_write_request(struct NetIORequest * nior)
+{
+	struct transmit_error * te;
+	const struct ip * ip;
+	const struct udphdr * udp;
+
+	ASSERT( nior != NULL && nior->nior_InUse );
+
+	nior->nior_InUse = FALSE;
+
+	ASSERT( num_write_requests_in_use > 0 );
+
+	num_write_requests_in_use--;
+
+	if(nior->nior_IOS2.ios2_Req.io_Error != OK)
+	{
+		num_transmit_errors++;
+
+		D(("write request 0x%08lx failed (error=%ld, wire error=%ld)",
+			nior,nior->nior_IOS2.ios2_Req.io_Error,nior->nior_IOS2.ios2_WireError));
+
+		/* If the oldest error has not been picked up yet, it
+		 * will be lost.
+		 */
+		if(num_pending_transmit_errors == MAX_TRANSMIT_ERRORS)
+		{
+			first_transmit_error = (first_transmit_error + 1) % MAX_TRANSMIT_ERRORS;
+			num_pending_transmit_errors--;
+		}
+
+		te = &transmit_errors[(first_transmit_error + num_pending_transmit_errors) % MAX_TRANSMIT_ERRORS];
+		num_pending_transmit_errors++;
+
+		memset(te,0,sizeof(*te));
+
+		te->te_PacketType	= nior->nior_IOS2.ios2_PacketType;
+		te->te_Error		= nior->nior_IOS2.ios2_Req.io_Error;
+		te->te_WireError	= nior->nior_IOS2.ios2_WireError;
+
+		/* Which transfer did the UDP datagram belong to? */
+		if(te->te_PacketType == ETHERTYPE_IP)
+		{
+			ip = nior->nior_Buffer;
+			udp = (const struct udphdr *)&ip[1];
+
+			te->te_IPv4Address = ip->ip_dst;
+
+			if(ip->ip_pr == IPPROTO_UDP)
+				te->te_UDPPortNumber = udp->uh_sport;
+		}
+	}
+}
+
+/****************************************************************************/
+
+/* Make the write requests which the driver has finished with available
+ * for use again.
+ */
+void
+handle_write_replies(void)
+{
+	struct NetIORequest * nior;
+
+	while((nior = (struct NetIORequest *)GetMsg(net_write_port)) != NULL)
+		reclaim_write_request(nior);
+}
+
+/****************************************************************************/
+
+/* Retrieve the oldest transmission error which has not been picked up
+ * yet. Returns TRUE if there was one, and FALSE otherwise.
+ */
+BOOL
+get_transmit_error(struct transmit_error * te)
+{
+	BOOL result = FALSE;
+
+	ASSERT( te != NULL );
+
+	if(num_pending_transmit_errors > 0)
+	{
+		(*te) = transmit_errors[first_transmit_error];
+
+		first_transmit_error = (first_transmit_error + 1) % MAX_TRANSMIT_ERRORS;
+		num_pending_transmit_errors--;
+
+		result = TRUE;
+	}
+
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Send the datagram which has been put together in the write request
+ * buffer, without waiting for the driver to finish. Then pick the write
+ * request to be used next, waiting for the driver to finish with one of
+ * them if all of them are still in use.
+ */
+void
+send_write_request(void)
+{
+	struct NetIORequest * nior;
+	ULONG stall_start;
+	int i;
+
+	ENTER();
+
+	ASSERT( write_request != NULL && NOT write_request->nior_InUse );
+
+	write_request->nior_InUse = TRUE;
+
+	SendIO((struct IORequest *)write_request);
+
+	num_write_requests_in_use++;
+
+	if(max_num_write_requests_in_use < num_write_requests_in_use)
+		max_num_write_requests_in_use = num_write_requests_in_use;
+
+	handle_write_replies();
+
+	while(TRUE)
+	{
+		for(i = 0 ; i < num_write_requests ; i++)
+		{
+			nior = write_requests[i];
+
+			if(NOT nior->nior_InUse)
+			{
+				write_request = nior;
+				goto out;
+			}
+		}
+
+		SHOWMSG("waiting for a write request to return");
+
+		stall_start = get_milliseconds();
+
+		WaitPort(net_write_port);
+
+		write_request_stall_time += get_milliseconds() - stall_start;
+		num_write_request_stalls++;
+
+		handle_write_replies();
+	}
+
+ out:
+
+	LEAVE();
+}
+
+/****************************************************************************/
+
 /* Find the SANA-II IORequest which corresponds to the bookkeeping
  * data structure which keeps track of all the network I/O requests
  * allocated by this program.
@@ -147,6 +397,96 @@ link_to_net_request(const struct MinNode * mn)
 
 /****************************************************************************/
 
+/* Allocate the arena, which must have room for the given number of I/O
+ * requests with buffers of the given size. Returns OK on success, and
+ * FAILURE otherwise.
+ */
+static int
+create_net_arena(int num_requests,ULONG buffer_size)
+{
+	int result = FAILURE;
+	ULONG slot_size;
+
+	ENTER();
+
+	NewList((struct List *)&spare_net_requests);
+
+	/* Each I/O request is followed by its buffer. */
+	slot_size = NET_ARENA_ROUND_UP(sizeof(struct NetIORequest)) + NET_ARENA_ROUND_UP(buffer_size + NET_BUFFER_SLACK);
+
+	net_arena_size = num_requests * slot_size;
+
+	/* AllocVec() does not promise the alignment we need, so
+	 * there has to be room for adjusting the start address.
+	 */
+	net_arena = AllocVec(net_arena_size + NET_BUFFER_ALIGNMENT - 1, MEMF_ANY|MEMF_PUBLIC);
+	if(net_arena == NULL)
+		goto out;
+
+	net_arena_start = (UBYTE *)NET_ARENA_ROUND_UP((ULONG)net_arena);
+	net_arena_used = 0;
+	net_arena_buffer_size = buffer_size;
+
+	D(("arena for %ld I/O requests, %lu bytes each", num_requests, slot_size));
+
+	result = OK;
+
+ out:
+
+	RETURN(result);
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Take an I/O request with a buffer of the given size out of the arena,
+ * reusing one which was freed before, if possible. Returns NULL if there
+ * is no room left, or if the buffer size does not match.
+ */
+static struct NetIORequest *
+allocate_from_net_arena(ULONG buffer_size)
+{
+	struct NetIORequest * nior = NULL;
+	ULONG request_size;
+
+	if(net_arena == NULL || buffer_size != net_arena_buffer_size)
+		goto out;
+
+	nior = (struct NetIORequest *)RemHead((struct List *)&spare_net_requests);
+	if(nior != NULL)
+	{
+		nior = link_to_net_request((struct MinNode *)nior);
+		goto out;
+	}
+
+	request_size = NET_ARENA_ROUND_UP(sizeof(*nior));
+
+	if(net_arena_used + request_size + NET_ARENA_ROUND_UP(buffer_size + NET_BUFFER_SLACK) > net_arena_size)
+		goto out;
+
+	nior = (struct NetIORequest *)&net_arena_start[net_arena_used];
+	net_arena_used += request_size;
+
+	nior->nior_Buffer = &net_arena_start[net_arena_used];
+	net_arena_used += NET_ARENA_ROUND_UP(buffer_size + NET_BUFFER_SLACK);
+
+ out:
+
+	if(nior != NULL)
+	{
+		APTR buffer = nior->nior_Buffer;
+
+		memset(nior,0,sizeof(*nior));
+
+		nior->nior_Buffer	= buffer;
+		nior->nior_InArena	= TRUE;
+	}
+
+	return(nior);
+}
+
+/****************************************************************************/
+
 /* Abort a network I/O request currently being processed.
  * Once this function returns the I/O request is ready
  * to be reused.
@@ -216,13 +556,23 @@ delete_net_request(struct NetIORequest * nior)
 			nior->nior_IOS2.ios2_Req.io_Device = NULL;
 		}
 
-		if(nior->nior_Buffer != NULL)
+		/* An I/O request taken from the arena is kept for reuse. */
+		if(nior->nior_InArena)
 		{
-			FreeVec(nior->nior_Buffer);
-			nior->nior_Buffer = NULL;
+			AddTail((struct List *)&spare_net_requests,(struct Node *)&nior->nior_Link);
 		}
+		else
+		{
+			if(nior->nior_BufferAllocation != NULL)
+			{
+				FreeVec(nior->nior_BufferAllocation);
+				nior->nior_BufferAllocation = NULL;
+			}
+
+			nior->nior_Buffer = NULL;
 
-		FreeVec(nior);
+			FreeVec(nior);
+		}
 	}
 
 	LEAVE();
@@ -244,9 +594,14 @@ duplicate_net_request(
 	ASSERT( orig->nior_IOS2.ios2_Req.io_Device != NULL );
 	ASSERT( orig->nior_Link.mln_Succ != NULL && orig->nior_Link.mln_Pred != NULL );
 
-	nior = (struct NetIORequest *)AllocVec(sizeof(*nior), MEMF_ANY|MEMF_PUBLIC|MEMF_CLEAR);
+	/* Use the arena if there is room left in it. */
+	nior = allocate_from_net_arena(buffer_size);
 	if(nior == NULL)
-		goto out;
+	{
+		nior = (struct NetIORequest *)AllocVec(sizeof(*nior), MEMF_ANY|MEMF_PUBLIC|MEMF_CLEAR);
+		if(nior == NULL)
+			goto out;
+	}
 
 	/* Keep track of this network I/O request, making it easier to clean up later. */
 	AddTail(&net_io_list,(struct Node *)&nior->nior_Link);
@@ -266,9 +621,17 @@ duplicate_net_request(
 
 	nior->nior_BufferSize = buffer_size;
 
-	nior->nior_Buffer = AllocVec(nior->nior_BufferSize, MEMF_ANY|MEMF_PUBLIC);
-	if(nior->nior_Buffer == NULL)
-		goto out;
+	/* The buffer must be aligned just like the buffers taken from
+	 * the arena, which AllocVec() does not promise.
+	 */
+	if(NOT nior->nior_InArena)
+	{
+		nior->nior_BufferAllocation = AllocVec(nior->nior_BufferSize + NET_BUFFER_SLACK + NET_BUFFER_ALIGNMENT - 1, MEMF_ANY|MEMF_PUBLIC);
+		if(nior->nior_BufferAllocation == NULL)
+			goto out;
+
+		nior->nior_Buffer = (APTR)NET_ARENA_ROUND_UP((ULONG)nior->nior_BufferAllocation);
+	}
 
 	result = nior;
 	nior = NULL;
@@ -315,6 +678,174 @@ create_net_request(struct MsgPort * reply_port)
 
 /****************************************************************************/
 
+/* Add another read request for ARP or IP packets, and start it. Returns OK
+ * on success, and FAILURE otherwise.
+ */
+static int
+add_read_request(UWORD type)
+{
+	struct NetIORequest * read_request;
+	int result = FAILURE;
+
+	read_request = duplicate_net_request(control_request, net_read_port, net_mtu);
+	if(read_request == NULL)
+		goto out;
+
+	send_net_io_read_request(read_request,type);
+
+	if(type == ETHERTYPE_ARP)
+		num_arp_read_requests++;
+	else
+		num_ip_read_requests++;
+
+	result = OK;
+
+ out:
+
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Put a read request which has returned back into circulation, unless
+ * there are more ARP read requests than needed, in which case it is
+ * freed instead.
+ */
+void
+restart_net_io_read_request(struct NetIORequest * nior)
+{
+	ASSERT( nior != NULL && NOT nior->nior_InUse );
+
+	if(nior->nior_Type == ETHERTYPE_ARP && num_arp_read_requests > wanted_num_arp_read_requests)
+	{
+		D(("freeing ARP read request 0x%08lx", nior));
+
+		delete_net_request(nior);
+
+		num_arp_read_requests--;
+	}
+	else
+	{
+		send_net_io_read_request(nior,nior->nior_Type);
+
+		num_read_requests_restarted++;
+	}
+}
+
+/****************************************************************************/
+
+/* Change the number of read requests for ARP packets. Few are needed
+ * once the Ethernet addresses of the computers the program talks to are
+ * known. Surplus read requests are freed as they return.
+ */
+void
+set_num_arp_read_requests(int num)
+{
+	wanted_num_arp_read_requests = num;
+
+	while(num_arp_read_requests < wanted_num_arp_read_requests)
+	{
+		if(add_read_request(ETHERTYPE_ARP) != OK)
+			break;
+	}
+}
+
+/****************************************************************************/
+
+/* Ask the network driver for its statistics. Returns OK on success,
+ * and FAILURE if the driver does not support this.
+ */
+static int
+get_global_stats(struct Sana2DeviceStats * stats)
+{
+	int result = FAILURE;
+
+	memset(stats,0,sizeof(*stats));
+
+	control_request->nior_IOS2.ios2_Req.io_Command	= S2_GETGLOBALSTATS;
+	control_request->nior_IOS2.ios2_StatData		= stats;
+	control_request->nior_IOS2.ios2_WireError		= 0;
+
+	if(DoIO((struct IORequest *)control_request) == OK)
+		result = OK;
+
+	control_request->nior_IOS2.ios2_StatData = NULL;
+
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Check every now and then if the network device missed frames because
+ * there were not enough read requests in circulation, and add more read
+ * requests for IP packets if necessary. The device counts the frames it
+ * could not store anywhere as overruns. It may also have received more
+ * frames of the kind which the program asked for than the program could
+ * possibly have picked up.
+ */
+void
+check_read_requests(const struct cmd_args * args)
+{
+	struct Sana2DeviceStats stats;
+	ULONG num_overruns_since, num_received_since;
+	ULONG now;
+	int num_to_add;
+
+	if(NOT global_stats_supported)
+		return;
+
+	now = get_milliseconds();
+	if(now - global_stats_time < READ_REQUEST_CHECK_INTERVAL)
+		return;
+
+	global_stats_time = now;
+
+	if(get_global_stats(&stats) != OK)
+	{
+		global_stats_supported = FALSE;
+		return;
+	}
+
+	num_overruns_since = stats.Overruns - previous_global_stats.Overruns;
+
+	num_received_since = (stats.PacketsReceived - previous_global_stats.PacketsReceived) -
+	                     (stats.UnknownTypesReceived - previous_global_stats.UnknownTypesReceived);
+
+	previous_global_stats = stats;
+
+	num_overruns += num_overruns_since;
+
+	if(num_overruns_since > 0 || num_received_since > num_read_requests_restarted + num_arp_read_requests + num_ip_read_requests)
+	{
+		/* Grow by half, as far as the limit and the memory available permit. */
+		num_to_add = num_ip_read_requests / 2;
+		if(num_to_add < 4)
+			num_to_add = 4;
+
+		if(num_to_add > MAX_IP_READ_REQUESTS - num_ip_read_requests)
+			num_to_add = MAX_IP_READ_REQUESTS - num_ip_read_requests;
+
+		if(num_to_add > 0 && (ULONG)num_to_add * net_mtu < AvailMem(MEMF_ANY) / 8)
+		{
+			if(args->Verbose)
+				Printf("The network device missed %lu frames; adding %ld read requests.\n",num_overruns_since,num_to_add);
+
+			D(("The network device missed %lu frames (%lu received, %lu restarted); adding %ld read requests.",
+				num_overruns_since,num_received_since,num_read_requests_restarted,num_to_add));
+
+			while(num_to_add-- > 0)
+			{
+				if(add_read_request(ETHERTYPE_IP) != OK)
+					break;
+			}
+		}
+	}
+
+	num_read_requests_restarted = 0;
+}
+
+/****************************************************************************/
+
 /* OpenDevice() will only open device drivers which are either currently
  * already in memory, or which can be found in "DEVS:", but SANA-II network
  * device drivers are typically found in "DEVS:Networks". This function
@@ -388,6 +919,8 @@ sana2_byte_copy_from_buff(
 	ASSERT( n <= from->nior_BufferSize );
 	ASSERT( from->nior_IOS2.ios2_Req.io_Device != NULL );
 
+	buffer_management_counts[bm_copy_from_buff]++;
+
 	/* Do not copy more data than the buffer will hold. */
 	if(n <= from->nior_BufferSize && from->nior_Buffer != NULL)
 	{
@@ -432,10 +965,26 @@ sana2_byte_copy_to_buff(
 	ASSERT( n <= to->nior_BufferSize );
 	ASSERT( to->nior_IOS2.ios2_Req.io_Device != NULL );
 
+	buffer_management_counts[bm_copy_to_buff]++;
+
 	/* Do not copy more data than the buffer will hold. */
 	if(n <= to->nior_BufferSize && to->nior_Buffer != NULL)
 	{
-		memmove(to->nior_Buffer,from,n);
+		/* If this could be a UDP datagram, calculate the checksum of
+		 * everything following the IP header while copying it, which
+		 * saves verify_udp_datagram_checksum() the trouble.
+		 */
+		if(to->nior_Type == ETHERTYPE_IP && n >= sizeof(struct ip) + sizeof(struct udphdr))
+		{
+			memmove(to->nior_Buffer,from,sizeof(struct ip));
+
+			to->nior_PayloadSum = in_cksum_copy(&((UBYTE *)to->nior_Buffer)[sizeof(struct ip)],&from[sizeof(struct ip)],n - sizeof(struct ip),0);
+			to->nior_PayloadSumValid = TRUE;
+		}
+		else
+		{
+			memmove(to->nior_Buffer,from,n);
+		}
 
 		result = TRUE;
 	}
@@ -451,15 +1000,137 @@ sana2_byte_copy_to_buff(
 
 /****************************************************************************/
 
+/* The same as sana2_byte_copy_from_buff(), except that the network driver's
+ * buffer must be written to 16 or 32 bits at a time. This is what the
+ * CMD_WRITE, S2_MULTICAST and S2_BROADCAST commands may use.
+ *
+ * The client's buffer is aligned, and it is followed by NET_BUFFER_SLACK
+ * bytes, which is why the number of bytes to copy can be rounded up.
+ */
+static LONG ASM SAVE_DS
+sana2_copy_from_buff16(
+	REG(a0,UWORD *						to),
+	REG(a1,const struct NetIORequest *	from),
+	REG(d0,ULONG						n))
+{
+	const UWORD * buffer;
+	LONG result = FALSE;
+
+	ASSERT( to != NULL || n == 0 );
+	ASSERT( n <= from->nior_BufferSize );
+
+	buffer_management_counts[bm_copy_from_buff16]++;
+
+	if(n <= from->nior_BufferSize && from->nior_Buffer != NULL)
+	{
+		buffer = from->nior_Buffer;
+
+		for(n = (n + 1) / 2 ; n > 0 ; n--)
+			(*to++) = (*buffer++);
+
+		result = TRUE;
+	}
+
+	return(result);
+}
+
+static LONG ASM SAVE_DS
+sana2_copy_from_buff32(
+	REG(a0,ULONG *						to),
+	REG(a1,const struct NetIORequest *	from),
+	REG(d0,ULONG						n))
+{
+	const ULONG * buffer;
+	LONG result = FALSE;
+
+	ASSERT( to != NULL || n == 0 );
+	ASSERT( n <= from->nior_BufferSize );
+
+	buffer_management_counts[bm_copy_from_buff32]++;
+
+	if(n <= from->nior_BufferSize && from->nior_Buffer != NULL)
+	{
+		buffer = from->nior_Buffer;
+
+		for(n = (n + 3) / 4 ; n > 0 ; n--)
+			(*to++) = (*buffer++);
+
+		result = TRUE;
+	}
+
+	return(result);
+}
+
+/* The same as sana2_byte_copy_to_buff(), except that the network driver's
+ * buffer must be read from 16 or 32 bits at a time. This is what the
+ * CMD_READ and S2_READORPHAN commands may use. Any bytes copied past the
+ * end of the data end up in the slack which follows the client's buffer.
+ */
+static LONG ASM SAVE_DS
+sana2_copy_to_buff16(
+	REG(a0,struct NetIORequest *	to),
+	REG(a1,const UWORD *			from),
+	REG(d0,ULONG					n))
+{
+	UWORD * buffer;
+	LONG result = FALSE;
+
+	ASSERT( from != NULL || n == 0 );
+	ASSERT( n <= to->nior_BufferSize );
+
+	buffer_management_counts[bm_copy_to_buff16]++;
+
+	if(n <= to->nior_BufferSize && to->nior_Buffer != NULL)
+	{
+		buffer = to->nior_Buffer;
+
+		for(n = (n + 1) / 2 ; n > 0 ; n--)
+			(*buffer++) = (*from++);
+
+		result = TRUE;
+	}
+
+	return(result);
+}
+
+static LONG ASM SAVE_DS
+sana2_copy_to_buff32(
+	REG(a0,struct NetIORequest *	to),
+	REG(a1,const ULONG *			from),
+	REG(d0,ULONG					n))
+{
+	ULONG * buffer;
+	LONG result = FALSE;
+
+	ASSERT( from != NULL || n == 0 );
+	ASSERT( n <= to->nior_BufferSize );
+
+	buffer_management_counts[bm_copy_to_buff32]++;
+
+	if(n <= to->nior_BufferSize && to->nior_Buffer != NULL)
+	{
+		buffer = to->nior_Buffer;
+
+		for(n = (n + 3) / 4 ; n > 0 ; n--)
+			(*buffer++) = (*from++);
+
+		result = TRUE;
+	}
+
+	return(result);
+}
+
+/****************************************************************************/
+
 /* Attempt to return the client's buffer address so that the network driver
  * may transmit its contents. This is what the CMD_WRITE, S2_MULTICAST and
  * S2_BROADCAST commands may use.
  *
  * Returns the address of the client's buffer if it matches the alignment
- * requirements; NULL otherwise.
+ * requirements (4 or 8 bytes); NULL otherwise.
  */
-static APTR ASM SAVE_DS
-sana2_dma_copy_from_buff32(REG(a0,const struct NetIORequest * from))
+static APTR
+dma_copy_from_buff(const struct NetIORequest * from,ULONG alignment)
 {
 	APTR result = NULL;
 
@@ -470,11 +1141,11 @@ sana2_dma_copy_from_buff32(REG(a0,const struct NetIORequest * from))
 	ASSERT( from != NULL );
 	ASSERT( from->nior_IOS2.ios2_Req.io_Device != NULL );
 
-	/* The buffer address must be a multiple of 4 (32 bit
-	 * alignment). We bail if this is not case, or if the
-	 * buffer address is invalid.
+	/* The buffer address must be a multiple of the
+	 * alignment. We bail if this is not case, or if
+	 * the buffer address is invalid.
 	 */
-	if((((ULONG)from->nior_Buffer) % 4) != 0 || from->nior_Buffer == NULL)
+	if((((ULONG)from->nior_Buffer) % alignment) != 0 || from->nior_Buffer == NULL)
 		goto out;
 
 	result = from->nior_Buffer;
@@ -490,12 +1161,12 @@ sana2_dma_copy_from_buff32(REG(a0,const struct NetIORequest * from))
  * and S2_READORPHAN commands may use.
  *
  * Returns the address of the client's buffer if it matches the alignment
- * requirements and if the size of the buffer is large enough to hold
- * the number of data bytes which the network driver may want to store
- * there; NULL otherwise.
+ * requirements (4 or 8 bytes) and if the size of the buffer is large
+ * enough to hold the number of data bytes which the network driver may
+ * want to store there; NULL otherwise.
  */
-static APTR ASM SAVE_DS
-sana2_dma_copy_to_buff32(REG(a0,const struct NetIORequest * to))
+static APTR
+dma_copy_to_buff(const struct NetIORequest * to,ULONG alignment)
 {
 	ULONG n, remaining_bytes;
 	APTR result = NULL;
@@ -509,13 +1180,13 @@ sana2_dma_copy_to_buff32(REG(a0,const struct NetIORequest * to))
 
 	/* How much data the driver may want to store in the buffer is
 	 * given in to->nior_IOS2.ios2_DataLength. We must round this
-	 * up to a multiple of 4 (32 bit alignment) to make sure that
-	 * we have that much space in the buffer.
+	 * up to a multiple of the alignment to make sure that we have
+	 * that much space in the buffer.
 	 */
 	n = to->nior_IOS2.ios2_DataLength;
 
-	remaining_bytes = 4 - (n % 4);
-	if(remaining_bytes < 4)
+	remaining_bytes = alignment - (n % alignment);
+	if(remaining_bytes < alignment)
 	{
 		/* Paranoia: avoid an overflow. */
 		if(n + remaining_bytes > n)
@@ -523,17 +1194,18 @@ sana2_dma_copy_to_buff32(REG(a0,const struct NetIORequest * to))
 	}
 
 	/* The client buffer must be large enough to store
-	 * as many bytes as the driver may want to. We
-	 * bail out if this is not the case.
+	 * as many bytes as the driver may want to. The
+	 * slack which follows the buffer counts, too.
+	 * We bail out if this is not the case.
 	 */
-	if(n > to->nior_BufferSize)
+	if(n > to->nior_BufferSize + NET_BUFFER_SLACK)
 		goto out;
 
-	/* The buffer address must be a multiple of 4 (32 bit
-	 * alignment). We bail if this is not case, or if the
-	 * buffer address is invalid.
+	/* The buffer address must be a multiple of the
+	 * alignment. We bail if this is not case, or if
+	 * the buffer address is invalid.
 	 */
-	if((((ULONG)to->nior_Buffer) % 4) != 0 || to->nior_Buffer == NULL)
+	if((((ULONG)to->nior_Buffer) % alignment) != 0 || to->nior_Buffer == NULL)
 		goto out;
 
 	result = to->nior_Buffer;
@@ -544,6 +1216,154 @@ sana2_dma_copy_to_buff32(REG(a0,const struct NetIORequest * to))
 	return(result);
 }
 
+/* These are the functions which the network driver calls, which
+ * keep count of how often DMA was possible, and how often not.
+ */
+static APTR ASM SAVE_DS
+sana2_dma_copy_from_buff32(REG(a0,const struct NetIORequest * from))
+{
+	APTR result;
+
+	result = dma_copy_from_buff(from,4);
+
+	buffer_management_counts[(result != NULL) ? bm_dma_copy_from_buff32 : bm_dma_copy_from_buff32_refused]++;
+
+	return(result);
+}
+
+static APTR ASM SAVE_DS
+sana2_dma_copy_to_buff32(REG(a0,const struct NetIORequest * to))
+{
+	APTR result;
+
+	result = dma_copy_to_buff(to,4);
+
+	buffer_management_counts[(result != NULL) ? bm_dma_copy_to_buff32 : bm_dma_copy_to_buff32_refused]++;
+
+	return(result);
+}
+
+static APTR ASM SAVE_DS
+sana2_dma_copy_from_buff64(REG(a0,const struct NetIORequest * from))
+{
+	APTR result;
+
+	result = dma_copy_from_buff(from,8);
+
+	buffer_management_counts[(result != NULL) ? bm_dma_copy_from_buff64 : bm_dma_copy_from_buff64_refused]++;
+
+	return(result);
+}
+
+static APTR ASM SAVE_DS
+sana2_dma_copy_to_buff64(REG(a0,const struct NetIORequest * to))
+{
+	APTR result;
+
+	result = dma_copy_to_buff(to,8);
+
+	buffer_management_counts[(result != NULL) ? bm_dma_copy_to_buff64 : bm_dma_copy_to_buff64_refused]++;
+
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Show how often the network driver used each of the buffer management
+ * functions, and how often DMA was not possible.
+ */
+void
+show_buffer_management_statistics(const struct cmd_args * args)
+{
+	static const char * names[bm_num_functions] =
+	{
+		"CopyToBuff",
+		"CopyFromBuff",
+		"CopyToBuff16",
+		"CopyFromBuff16",
+		"CopyToBuff32",
+		"CopyFromBuff32",
+		"DMACopyToBuff32",
+		"DMACopyToBuff32 (refused)",
+		"DMACopyFromBuff32",
+		"DMACopyFromBuff32 (refused)",
+		"DMACopyToBuff64",
+		"DMACopyToBuff64 (refused)",
+		"DMACopyFromBuff64",
+		"DMACopyFromBuff64 (refused)",
+	};
+
+	int i;
+
+	for(i = 0 ; i < bm_num_functions ; i++)
+	{
+		if(buffer_management_counts[i] == 0)
+			continue;
+
+		if(args->Verbose)
+			Printf("%s: %lu calls.\n",names[i],buffer_management_counts[i]);
+
+		D(("%s: %lu calls.",names[i],buffer_management_counts[i]));
+	}
+}
+
+/****************************************************************************/
+
+/* Tell the device to receive or to stop receiving the frames sent to
+ * the Ethernet multicast address which corresponds to an IPv4 multicast
+ * group. The address is made up of 01:00:5E, followed by the lower 23
+ * bits of the group address (RFC 1112). Returns OK on success, and
+ * FAILURE otherwise.
+ */
+static int
+change_multicast_group(UWORD command,ULONG ipv4_address)
+{
+	UBYTE * address = control_request->nior_IOS2.ios2_SrcAddr;
+	int result = FAILURE;
+
+	ENTER();
+
+	ASSERT( control_request != NULL );
+	ASSERT( NOT control_request->nior_InUse );
+
+	memset(address,0,SANA2_MAX_ADDR_BYTES);
+
+	address[0] = 0x01;
+	address[1] = 0x00;
+	address[2] = 0x5E;
+	address[3] = (ipv4_address >> 16) & 0x7F;
+	address[4] = (ipv4_address >>  8) & 0xFF;
+	address[5] =  ipv4_address        & 0xFF;
+
+	control_request->nior_IOS2.ios2_Req.io_Command	= command;
+	control_request->nior_IOS2.ios2_WireError		= 0;
+
+	if(DoIO((struct IORequest *)control_request) == OK)
+		result = OK;
+
+	RETURN(result);
+	return(result);
+}
+
+/* Begin receiving the datagrams sent to an IPv4 multicast group. The
+ * device keeps count of how often the same address was added, so that
+ * several transfers may join the same group.
+ */
+int
+join_multicast_group(ULONG ipv4_address)
+{
+	return(change_multicast_group(S2_ADDMULTICASTADDRESS,ipv4_address));
+}
+
+/* Stop receiving the datagrams sent to an IPv4 multicast group, which
+ * must have been joined before.
+ */
+void
+leave_multicast_group(ULONG ipv4_address)
+{
+	change_multicast_group(S2_DELMULTICASTADDRESS,ipv4_address);
+}
+
 /****************************************************************************/
 
 /* This function stops all I/O operations and releases all the resources
@@ -559,6 +1379,24 @@ network_cleanup(void)
 		struct NetIORequest * nior;
 		struct MinNode * mn;
 		struct MinNode * mn_next;
+		int i;
+
+		/* The last datagrams sent, such as the final acknowledgement
+		 * of a transfer, should still go out.
+		 */
+		for(i = 0 ; i < num_write_requests ; i++)
+		{
+			nior = write_requests[i];
+
+			if(nior->nior_InUse)
+			{
+				D(("waiting for write request 0x%08lx to return...", nior));
+
+				WaitIO((struct IORequest *)nior);
+
+				nior->nior_InUse = FALSE;
+			}
+		}
 
 		/* Try to abort all pending I/O requests, and for good measure
 		 * also render the copying functions useless.
@@ -628,6 +1466,13 @@ network_cleanup(void)
 		control_request = NULL;
 	}
 
+	/* This releases all the I/O requests taken from the arena. */
+	if(net_arena != NULL)
+	{
+		FreeVec(net_arena);
+		net_arena = NULL;
+	}
+
 	if(net_read_port != NULL)
 	{
 		DeleteMsgPort(net_read_port);
@@ -640,6 +1485,17 @@ network_cleanup(void)
 		net_control_port = NULL;
 	}
 
+	if(net_write_port != NULL)
+	{
+		DeleteMsgPort(net_write_port);
+		net_write_port = NULL;
+	}
+
+	write_request = NULL;
+	num_write_requests = 0;
+
+	num_arp_read_requests = num_ip_read_requests = 0;
+
 	LEAVE();
 }
 
@@ -695,6 +1551,48 @@ sana2_hook_function(
 			result = (LONG)sana2_dma_copy_from_buff32(sana2req);
 			break;
 
+		case S2_CopyToBuff16:
+
+			SHOWMSG("S2_CopyToBuff16");
+
+			result = sana2_copy_to_buff16(sana2req,schm->schm_From,schm->schm_Size);
+			break;
+
+		case S2_CopyFromBuff16:
+
+			SHOWMSG("S2_CopyFromBuff16");
+
+			result = sana2_copy_from_buff16(schm->schm_To,sana2req,schm->schm_Size);
+			break;
+
+		case S2_CopyToBuff32:
+
+			SHOWMSG("S2_CopyToBuff32");
+
+			result = sana2_copy_to_buff32(sana2req,schm->schm_From,schm->schm_Size);
+			break;
+
+		case S2_CopyFromBuff32:
+
+			SHOWMSG("S2_CopyFromBuff32");
+
+			result = sana2_copy_from_buff32(schm->schm_To,sana2req,schm->schm_Size);
+			break;
+
+		case S2_DMACopyToBuff64:
+
+			SHOWMSG("S2_DMACopyToBuff64");
+
+			result = (LONG)sana2_dma_copy_to_buff64(sana2req);
+			break;
+
+		case S2_DMACopyFromBuff64:
+
+			SHOWMSG("S2_DMACopyFromBuff64");
+
+			result = (LONG)sana2_dma_copy_from_buff64(sana2req);
+			break;
+
 		default:
 
 			D(("unsupported method %ld (0x%08lx)", schm->schm_Method, schm->schm_Method));
@@ -723,8 +1621,14 @@ network_setup(BPTR error_output, const struct cmd_args * args)
 	{
 		{ S2_CopyFromBuff,		(ULONG)sana2_byte_copy_from_buff },
 		{ S2_CopyToBuff,		(ULONG)sana2_byte_copy_to_buff },
+		{ S2_CopyFromBuff16,	(ULONG)sana2_copy_from_buff16 },
+		{ S2_CopyToBuff16,		(ULONG)sana2_copy_to_buff16 },
+		{ S2_CopyFromBuff32,	(ULONG)sana2_copy_from_buff32 },
+		{ S2_CopyToBuff32,		(ULONG)sana2_copy_to_buff32 },
 		{ S2_DMACopyFromBuff32,	(ULONG)sana2_dma_copy_from_buff32 },
 		{ S2_DMACopyToBuff32,	(ULONG)sana2_dma_copy_to_buff32 },
+		{ S2_DMACopyFromBuff64,	(ULONG)sana2_dma_copy_from_buff64 },
+		{ S2_DMACopyToBuff64,	(ULONG)sana2_dma_copy_to_buff64 },
 
 		{ TAG_END, 0 }
 	};
@@ -734,8 +1638,14 @@ network_setup(BPTR error_output, const struct cmd_args * args)
 	{
 		S2_CopyToBuff,
 		S2_CopyFromBuff,
+		S2_CopyToBuff16,
+		S2_CopyFromBuff16,
+		S2_CopyToBuff32,
+		S2_CopyFromBuff32,
 		S2_DMACopyToBuff32,
 		S2_DMACopyFromBuff32,
+		S2_DMACopyToBuff64,
+		S2_DMACopyFromBuff64,
 
 		TAG_END
 	};
@@ -749,8 +1659,10 @@ network_setup(BPTR error_output, const struct cmd_args * args)
 	char other_wire_error_text[100];
 	UBYTE default_ethernet_address[SANA2_MAX_ADDR_BYTES];
 	int result = FAILURE;
-	struct NetIORequest * read_request;
 	ULONG buffer_size = 1500;
+	int num_packets_in_flight;
+	int num_wanted;
+	int num_sessions;
 	LONG error;
 	int i;
 
@@ -812,6 +1724,17 @@ network_setup(BPTR error_output, const struct cmd_args * args)
 
 	net_control_port = CreateMsgPort();
 	if(net_control_port == NULL)
+	{
+		if(!args->Quiet)
+			FPrintf(error_output, "%s: Could not create network control MsgPort.\n","TFTPClient");
+
+		D(("Could not create network control MsgPort."));
+
+		goto out;
+	}
+
+	net_write_port = CreateMsgPort();
+	if(net_write_port == NULL)
 	{
 		if(!args->Quiet)
 			FPrintf(error_output, "%s: Could not create network write MsgPort.\n","TFTPClient");
@@ -1065,45 +1988,110 @@ network_setup(BPTR error_output, const struct cmd_args * args)
 	if(error == OK)
 		memmove(local_ethernet_address,default_ethernet_address,sizeof(local_ethernet_address));
 
-	SHOWMSG("duplicating I/O request for write operations");
+	/* If the server may send several data blocks in a row without waiting for
+	 * us to acknowledge them, there must be enough read requests to receive
+	 * a whole window of data blocks, with room to spare. Several transfers
+	 * may be in progress at the same time, each with a window of its own.
+	 * When serving files, there may be as many transfers as permitted.
+	 */
+	if(args->Sessions != NULL)
+		num_sessions = (*args->Sessions);
+	else if (args->Server)
+		num_sessions = MAX_SESSIONS;
+	else
+		num_sessions = DEFAULT_SESSIONS;
 
-	write_request = duplicate_net_request(control_request, NULL, buffer_size);
-	if(write_request == NULL)
-	{
-		if(!args->Quiet)
-			PrintFault(ERROR_NO_FREE_STORE,"TFTPClient");
+	num_packets_in_flight = ((args->WindowSize != NULL) ? (*args->WindowSize) : DEFAULT_WINDOWSIZE) * num_sessions;
 
-		D(("could not create write request"));
+	/* If the driver tells us how many frames it had to drop, we can
+	 * start with just the packets expected to be in flight, and add
+	 * more read requests later if these turn out not to be enough.
+	 * Otherwise we had better play it safe.
+	 */
+	global_stats_supported = (BOOL)(get_global_stats(&previous_global_stats) == OK);
+	global_stats_time = get_milliseconds();
 
-		goto out;
-	}
+	if(global_stats_supported)
+		num_wanted = num_packets_in_flight + 4;
+	else
+		num_wanted = 2 * num_packets_in_flight;
 
-	SHOWMSG("duplicating I/O request for ARP packets");
+	/* Do not tie up more than a fair share of the memory available
+	 * in packet buffers.
+	 */
+	if(num_wanted > (int)(AvailMem(MEMF_ANY) / 8 / buffer_size))
+		num_wanted = AvailMem(MEMF_ANY) / 8 / buffer_size;
+
+	if(num_wanted < 8)
+		num_wanted = 8;
+	else if (num_wanted > MAX_IP_READ_REQUESTS)
+		num_wanted = MAX_IP_READ_REQUESTS;
+
+	/* There should be enough write requests for a whole window of
+	 * data blocks to be on its way while the next packet is being
+	 * put together.
+	 */
+	num_write_requests = ((args->WindowSize != NULL) ? (*args->WindowSize) : DEFAULT_WINDOWSIZE) + 2;
+	if(num_write_requests < MIN_WRITE_REQUESTS)
+		num_write_requests = MIN_WRITE_REQUESTS;
+	else if (num_write_requests > MAX_WRITE_REQUESTS)
+		num_write_requests = MAX_WRITE_REQUESTS;
+
+	/* All the I/O requests and their buffers come out of a single
+	 * block of memory. If the read request pool grows later, or if
+	 * there is no single block of memory large enough, the I/O
+	 * requests will be allocated separately.
+	 */
+	if(create_net_arena(num_write_requests + NUM_ARP_READ_REQUESTS + num_wanted, buffer_size) != OK)
+		D(("could not allocate memory for I/O request arena"));
 
-	/* We set up four ARP read requests and start them (asynchronously). */
-	for(i = 0 ; i < 4 ; i++)
+	SHOWMSG("duplicating I/O requests for write operations");
+
+	for(i = 0 ; i < num_write_requests ; i++)
 	{
-		read_request = duplicate_net_request(control_request, net_read_port, buffer_size);
-		if(read_request == NULL)
+		write_requests[i] = duplicate_net_request(control_request, net_write_port, buffer_size);
+		if(write_requests[i] == NULL)
 		{
+			num_write_requests = i;
+
 			if(!args->Quiet)
 				PrintFault(ERROR_NO_FREE_STORE,"TFTPClient");
 
-			D(("could not create ARP read request"));
+			D(("could not create write request"));
 
 			goto out;
 		}
+	}
+
+	write_request = write_requests[0];
+
+	net_mtu = buffer_size;
+
+	SHOWMSG("duplicating I/O request for ARP packets");
+
+	/* We set up four ARP read requests and start them (asynchronously).
+	 * Once the Ethernet addresses of the servers are known, fewer
+	 * will do.
+	 */
+	set_num_arp_read_requests(NUM_ARP_READ_REQUESTS);
+	if(num_arp_read_requests < NUM_ARP_READ_REQUESTS)
+	{
+		if(!args->Quiet)
+			PrintFault(ERROR_NO_FREE_STORE,"TFTPClient");
 
-		send_net_io_read_request(read_request,ETHERTYPE_ARP);
+		D(("could not create ARP read request"));
+
+		goto out;
 	}
 
 	SHOWMSG("duplicating I/O request for IP packets");
 
-	/* We set up eight IP read requests and start them (asynchronously). */
-	for(i = 0 ; i < 8 ; i++)
+	D(("%ld packets in flight, starting with %ld IP read requests (global stats %s)",
+		num_packets_in_flight,num_wanted,global_stats_supported ? "supported" : "not supported"));
+
+	for(i = 0 ; i < num_wanted ; i++)
 	{
-		read_request = duplicate_net_request(control_request, net_read_port, buffer_size);
-		if(read_request == NULL)
+		if(add_read_request(ETHERTYPE_IP) != OK)
 		{
 			if(!args->Quiet)
 				PrintFault(ERROR_NO_FREE_STORE,"TFTPClient");
@@ -1112,8 +2100,6 @@ network_setup(BPTR error_output, const struct cmd_args * args)
 
 			goto out;
 		}
-
-		send_net_io_read_request(read_request,ETHERTYPE_IP);
 	}
 
 	result = OK;
@@ -61,6 +61,49 @@
 #define	ETHERTYPE_IP	0x0800	/* IP protocol */
 #define ETHERTYPE_ARP	0x0806	/* Address resolution protocol */
 
+/* Upper limit for the number of IP read requests kept in circulation,
+ * which may otherwise grow large with many transfers in progress.
+ */
+#define MAX_IP_READ_REQUESTS	128
+
+/* Number of ARP read requests kept in circulation while the Ethernet
+ * address of a server is being looked up, and at other times.
+ */
+#define NUM_ARP_READ_REQUESTS	4
+#define MIN_ARP_READ_REQUESTS	1
+
+/* How often the network device statistics are checked to find out
+ * if more read requests are needed, in milliseconds.
+ */
+#define READ_REQUEST_CHECK_INTERVAL	1000
+
+/* Lower and upper limits for the number of write requests which may be
+ * processed by the network driver at the same time.
+ */
+#define MIN_WRITE_REQUESTS		4
+#define MAX_WRITE_REQUESTS		32
+
+/* How many transmission errors are remembered until they are picked
+ * up with get_transmit_error().
+ */
+#define MAX_TRANSMIT_ERRORS		16
+
+/****************************************************************************/
+
+/* The I/O request buffers taken from the arena begin at an address which
+ * is a multiple of this many bytes, which suits both the DMA copying
+ * functions and the CPU data cache line size.
+ */
+#define NET_BUFFER_ALIGNMENT	32
+
+#define NET_ARENA_ROUND_UP(n) (((n) + NET_BUFFER_ALIGNMENT - 1) & ~(NET_BUFFER_ALIGNMENT - 1))
+
+/* Each buffer is followed by this many bytes, so that the network driver
+ * may round up the number of bytes it copies to a multiple of 8 without
+ * running past the end of the buffer.
+ */
+#define NET_BUFFER_SLACK		8
+
 /****************************************************************************/
 
 /* This is a standard IOSana2Req type IORequest with some extra data added on
@@ -80,16 +123,49 @@ struct NetIORequest
 
 	APTR				nior_Buffer;		/* Address of transmission buffer */
 	ULONG				nior_BufferSize;	/* Size of transmission buffer in bytes */
+
+	ULONG				nior_PayloadSum;	/* Checksum of the data following the IP header, not yet folded */
+	BOOL				nior_PayloadSumValid;	/* True if the checksum was calculated while copying the data */
+
+	APTR				nior_BufferAllocation;	/* Memory allocated for the buffer, unless taken from the arena */
+	BOOL				nior_InArena;		/* True if request and buffer were taken from the arena */
+};
+
+/****************************************************************************/
+
+/* A datagram which the network driver could not send. */
+struct transmit_error
+{
+	UWORD	te_PacketType;		/* Either ETHERTYPE_IP or ETHERTYPE_ARP */
+	ULONG	te_IPv4Address;		/* Where an IP datagram was going to */
+	int		te_UDPPortNumber;	/* Our UDP port number, if it was a UDP datagram, 0 otherwise */
+	LONG	te_Error;			/* The io_Error value */
+	ULONG	te_WireError;		/* The ios2_WireError value */
 };
 
 /****************************************************************************/
 
 extern struct MsgPort * net_read_port;
+extern struct MsgPort * net_write_port;
+
+extern int num_arp_read_requests;
+extern int num_ip_read_requests;
+extern ULONG num_overruns;
 
 /****************************************************************************/
 
 extern struct NetIORequest * write_request;
 
+extern ULONG num_write_requests_in_use;
+extern ULONG max_num_write_requests_in_use;
+extern ULONG num_write_request_stalls;
+extern ULONG write_request_stall_time;
+extern ULONG num_transmit_errors;
+
+/****************************************************************************/
+
+extern ULONG net_mtu;
+
 /****************************************************************************/
 
 extern UBYTE local_ethernet_address[SANA2_MAX_ADDR_BYTES];
@@ -101,6 +177,15 @@ extern ULONG remote_ipv4_address;
 /****************************************************************************/
 
 extern void send_net_io_read_request(struct NetIORequest * nior,UWORD type);
+extern void restart_net_io_read_request(struct NetIORequest * nior);
+extern void set_num_arp_read_requests(int num);
+extern void check_read_requests(const struct cmd_args * args);
+extern void show_buffer_management_statistics(const struct cmd_args * args);
+extern void handle_write_replies(void);
+extern BOOL get_transmit_error(struct transmit_error * te);
+extern void send_write_request(void);
+extern int join_multicast_group(ULONG ipv4_address);
+extern void leave_multicast_group(ULONG ipv4_address);
 extern void network_cleanup(void);
 extern int network_setup(BPTR error_output, const struct cmd_args * args);
 
@@ -98,12 +98,17 @@
  * SUCH DAMAGE.
  */
 
+#if defined(TESTING)
+
 /*
  * in_cksum --
  *      Checksum routine for Internet Protocol family headers (C Version)
+ *
+ * This is the original, which test_in_cksum() compares the faster
+ * version below against.
  */
 int
-in_cksum (const void * addr, int len)
+reference_in_cksum (const void * addr, int len)
 {
 	int nleft = len;
 	const UWORD *w = addr;
@@ -136,6 +141,267 @@ in_cksum (const void * addr, int len)
 	return (answer);
 }
 
+#endif /* TESTING */
+
+/****************************************************************************/
+
+/* One's complement addition of 32 bit words: the carry out of the top
+ * bit wraps around into the bottom bit. Because this is big-endian
+ * data, the sum folds down to the same result as adding the 16 bit
+ * words one at a time.
+ */
+#define ADD_WITH_CARRY(sum,x) \
+	do \
+	{ \
+		ULONG _x = (x); \
+		(sum) += _x; \
+		if((sum) < _x) \
+			(sum)++; \
+	} \
+	while(0)
+
+/* Add len bytes to the Internet checksum (RFC 1071) in progress, reading
+ * 32 bits at a time, 32 bytes per loop iteration, instead of adding one
+ * 16 bit word at a time. The data may start at any address, but only at
+ * even addresses is word and longword access safe on the 68000. Unless
+ * this is the last part of the data to be checksummed, len must be even.
+ * The sum returned still needs to be folded with in_cksum_fold().
+ */
+ULONG
+in_cksum_partial (const void * addr, int len, ULONG sum)
+{
+	const UBYTE * b = addr;
+	const ULONG * l;
+
+	if((((ULONG)b) & 1) != 0)
+	{
+		while(len > 1)
+		{
+			ADD_WITH_CARRY(sum,(((ULONG)b[0]) << 8) | b[1]);
+
+			b += 2;
+			len -= 2;
+		}
+	}
+	else
+	{
+		/* Get to a longword boundary first. */
+		if((((ULONG)b) & 2) != 0 && len > 1)
+		{
+			ADD_WITH_CARRY(sum,*(const UWORD *)b);
+
+			b += 2;
+			len -= 2;
+		}
+
+		l = (const ULONG *)b;
+
+		#if defined(__GNUC__) && defined(__mc68000__)
+		{
+			/* The X flag carries from one addition to the next,
+			 * and move.l leaves it alone.
+			 */
+			while(len >= 32)
+			{
+				__asm__ __volatile__ (
+					"move.l %1@+,%%d0\n\t"
+					"add.l %%d0,%0\n\t"
+					"move.l %1@+,%%d0\n\t"
+					"addx.l %%d0,%0\n\t"
+					"move.l %1@+,%%d0\n\t"
+					"addx.l %%d0,%0\n\t"
+					"move.l %1@+,%%d0\n\t"
+					"addx.l %%d0,%0\n\t"
+					"move.l %1@+,%%d0\n\t"
+					"addx.l %%d0,%0\n\t"
+					"move.l %1@+,%%d0\n\t"
+					"addx.l %%d0,%0\n\t"
+					"move.l %1@+,%%d0\n\t"
+					"addx.l %%d0,%0\n\t"
+					"move.l %1@+,%%d0\n\t"
+					"addx.l %%d0,%0\n\t"
+					"moveq #0,%%d0\n\t"
+					"addx.l %%d0,%0"
+					: "+d" (sum), "+a" (l)
+					:
+					: "d0", "cc", "memory");
+
+				len -= 32;
+			}
+		}
+		#else
+		{
+			while(len >= 32)
+			{
+				ADD_WITH_CARRY(sum,l[0]);
+				ADD_WITH_CARRY(sum,l[1]);
+				ADD_WITH_CARRY(sum,l[2]);
+				ADD_WITH_CARRY(sum,l[3]);
+				ADD_WITH_CARRY(sum,l[4]);
+				ADD_WITH_CARRY(sum,l[5]);
+				ADD_WITH_CARRY(sum,l[6]);
+				ADD_WITH_CARRY(sum,l[7]);
+
+				l += 8;
+				len -= 32;
+			}
+		}
+		#endif /* __GNUC__ && __mc68000__ */
+
+		while(len >= 4)
+		{
+			ADD_WITH_CARRY(sum,*l++);
+
+			len -= 4;
+		}
+
+		b = (const UBYTE *)l;
+
+		if(len > 1)
+		{
+			ADD_WITH_CARRY(sum,*(const UWORD *)b);
+
+			b += 2;
+			len -= 2;
+		}
+	}
+
+	/* mop up an odd byte, if necessary */
+	if(len == 1)
+		ADD_WITH_CARRY(sum,((ULONG)b[0]) << 8);
+
+	return(sum);
+}
+
+/****************************************************************************/
+
+/* Copy len bytes and add them to the Internet checksum in progress at the
+ * same time, so that the data has to be read only once. The same rules
+ * as for in_cksum_partial() apply.
+ */
+ULONG
+in_cksum_copy (void * to, const void * from, int len, ULONG sum)
+{
+	const ULONG * s;
+	ULONG * d;
+	ULONG x;
+
+	/* Word and longword access is only safe if both
+	 * addresses are even.
+	 */
+	if(((((ULONG)to) | ((ULONG)from)) & 1) != 0)
+	{
+		memmove(to,from,len);
+
+		return(in_cksum_partial(to,len,sum));
+	}
+
+	s = from;
+	d = to;
+
+	#if defined(__GNUC__) && defined(__mc68000__)
+	{
+		while(len >= 32)
+		{
+			__asm__ __volatile__ (
+				"move.l %1@+,%%d0\n\t"
+				"move.l %%d0,%2@+\n\t"
+				"add.l %%d0,%0\n\t"
+				"move.l %1@+,%%d0\n\t"
+				"move.l %%d0,%2@+\n\t"
+				"addx.l %%d0,%0\n\t"
+				"move.l %1@+,%%d0\n\t"
+				"move.l %%d0,%2@+\n\t"
+				"addx.l %%d0,%0\n\t"
+				"move.l %1@+,%%d0\n\t"
+				"move.l %%d0,%2@+\n\t"
+				"addx.l %%d0,%0\n\t"
+				"move.l %1@+,%%d0\n\t"
+				"move.l %%d0,%2@+\n\t"
+				"addx.l %%d0,%0\n\t"
+				"move.l %1@+,%%d0\n\t"
+				"move.l %%d0,%2@+\n\t"
+				"addx.l %%d0,%0\n\t"
+				"move.l %1@+,%%d0\n\t"
+				"move.l %%d0,%2@+\n\t"
+				"addx.l %%d0,%0\n\t"
+				"move.l %1@+,%%d0\n\t"
+				"move.l %%d0,%2@+\n\t"
+				"addx.l %%d0,%0\n\t"
+				"moveq #0,%%d0\n\t"
+				"addx.l %%d0,%0"
+				: "+d" (sum), "+a" (s), "+a" (d)
+				:
+				: "d0", "cc", "memory");
+
+			len -= 32;
+		}
+	}
+	#else
+	{
+		while(len >= 32)
+		{
+			x = s[0]; d[0] = x; ADD_WITH_CARRY(sum,x);
+			x = s[1]; d[1] = x; ADD_WITH_CARRY(sum,x);
+			x = s[2]; d[2] = x; ADD_WITH_CARRY(sum,x);
+			x = s[3]; d[3] = x; ADD_WITH_CARRY(sum,x);
+			x = s[4]; d[4] = x; ADD_WITH_CARRY(sum,x);
+			x = s[5]; d[5] = x; ADD_WITH_CARRY(sum,x);
+			x = s[6]; d[6] = x; ADD_WITH_CARRY(sum,x);
+			x = s[7]; d[7] = x; ADD_WITH_CARRY(sum,x);
+
+			s += 8;
+			d += 8;
+			len -= 32;
+		}
+	}
+	#endif /* __GNUC__ && __mc68000__ */
+
+	while(len >= 4)
+	{
+		x = (*s++);
+		(*d++) = x;
+
+		ADD_WITH_CARRY(sum,x);
+
+		len -= 4;
+	}
+
+	/* The rest is at most three bytes long. */
+	if(len > 0)
+	{
+		memmove(d,s,len);
+
+		sum = in_cksum_partial(d,len,sum);
+	}
+
+	return(sum);
+}
+
+/****************************************************************************/
+
+/* Fold the 32 bit sum down to 16 bits and return its complement, which
+ * is the Internet checksum.
+ */
+int
+in_cksum_fold (ULONG sum)
+{
+	/* add back carry outs from top 16 bits to low 16 bits */
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += (sum >> 16);
+
+	return ((UWORD)~sum);
+}
+
+/****************************************************************************/
+
+/* Compute the Internet checksum of len bytes. */
+int
+in_cksum (const void * addr, int len)
+{
+	return(in_cksum_fold(in_cksum_partial(addr,len,0)));
+}
+
 /****************************************************************************/
 
 /* inet_aton() was borrowed from the 4.4BSD-Lite2 libc code.
@@ -310,88 +576,238 @@ inet_aton(const char *cp, unsigned long * addr)
 
 /****************************************************************************/
 
-/* Fill the write request transmission buffer with an IP datagram, containing
- * a UDP datagram, which in turn contains protocol data for the TFTP server to
- * receive. The UDP datagram will be initialized to use the given source and
- * destination port numbers. We also calculate both the UDP and IP datagram
- * checksums so that transmission errors are less likely to be overlooked.
+/* The number of UDP datagrams sent, and how many bytes had to be copied
+ * into the transmission buffer for them.
+ */
+ULONG num_udp_datagrams_sent;
+ULONG num_udp_bytes_copied;
+
+/****************************************************************************/
+
+/* The IP and UDP headers of the datagrams which a transfer sends only
+ * differ in their length and checksum fields. This is what they look like
+ * otherwise, along with the checksums of the fixed parts, to which only
+ * the length and the payload checksum need to be added (RFC 1624).
+ */
+struct udp_header_template
+{
+	ULONG			uht_LocalAddress;
+	ULONG			uht_RemoteAddress;
+	UWORD			uht_ClientPort;
+	UWORD			uht_ServerPort;
+
+	struct ip		uht_IP;
+	struct udphdr	uht_UDP;
+
+	ULONG			uht_IPHeaderSum;		/* IP header, without ip_len */
+	ULONG			uht_PseudoHeaderSum;	/* pseudo header and UDP header, without the lengths */
+};
+
+/* There is one template for each transfer in progress, more or less.
+ * If there are more transfers than templates, the oldest template is
+ * replaced.
+ */
+#define NUM_UDP_HEADER_TEMPLATES 16
+
+static struct udp_header_template	udp_header_templates[NUM_UDP_HEADER_TEMPLATES];
+static int							num_udp_header_templates;
+static int							next_udp_header_template;
+
+/****************************************************************************/
+
+/* Find the header template for the datagrams sent from the client port to
+ * the server port of the remote computer selected, or set one up.
+ */
+static const struct udp_header_template *
+get_udp_header_template(int client_port_number,int server_port_number)
+{
+	struct udp_header_template * uht;
+	ULONG sum;
+	int i;
+
+	for(i = 0 ; i < num_udp_header_templates ; i++)
+	{
+		uht = &udp_header_templates[i];
+
+		if(uht->uht_ClientPort == client_port_number &&
+		   uht->uht_ServerPort == server_port_number &&
+		   uht->uht_RemoteAddress == remote_ipv4_address &&
+		   uht->uht_LocalAddress == local_ipv4_address)
+		{
+			goto out;
+		}
+	}
+
+	uht = &udp_header_templates[next_udp_header_template];
+
+	next_udp_header_template = (next_udp_header_template + 1) % NUM_UDP_HEADER_TEMPLATES;
+	if(num_udp_header_templates < NUM_UDP_HEADER_TEMPLATES)
+		num_udp_header_templates++;
+
+	memset(uht,0,sizeof(*uht));
+
+	uht->uht_LocalAddress	= local_ipv4_address;
+	uht->uht_RemoteAddress	= remote_ipv4_address;
+	uht->uht_ClientPort		= client_port_number;
+	uht->uht_ServerPort		= server_port_number;
+
+	/* The type of service, identification and fragment
+	 * offset fields remain 0.
+	 */
+	uht->uht_IP.ip_v_hl		= (IPVERSION << 4) | 5;
+	uht->uht_IP.ip_ttl		= 64;
+	uht->uht_IP.ip_pr		= IPPROTO_UDP;
+	uht->uht_IP.ip_src		= local_ipv4_address;
+	uht->uht_IP.ip_dst		= remote_ipv4_address;
+
+	uht->uht_IPHeaderSum = in_cksum_partial(&uht->uht_IP,sizeof(uht->uht_IP),0);
+
+	uht->uht_UDP.uh_sport	= client_port_number;
+	uht->uht_UDP.uh_dport	= server_port_number;
+
+	sum = 0;
+
+	ADD_WITH_CARRY(sum,local_ipv4_address);
+	ADD_WITH_CARRY(sum,remote_ipv4_address);
+	ADD_WITH_CARRY(sum,IPPROTO_UDP);
+	ADD_WITH_CARRY(sum,(UWORD)client_port_number);
+	ADD_WITH_CARRY(sum,(UWORD)server_port_number);
+
+	uht->uht_PseudoHeaderSum = sum;
+
+ out:
+
+	return(uht);
+}
+
+/****************************************************************************/
+
+/* Return the address of the UDP datagram payload in the write request
+ * transmission buffer, which follows the space reserved for the IP and
+ * UDP headers. The payload can be put together right there, and then sent
+ * with send_udp_payload(), without having to be copied first. If not NULL,
+ * max_length_ptr will receive the number of payload bytes which the buffer
+ * can hold.
+ */
+UBYTE *
+get_udp_payload_buffer(int * max_length_ptr)
+{
+	UBYTE * packet = write_request->nior_Buffer;
+
+	if(max_length_ptr != NULL)
+		(*max_length_ptr) = write_request->nior_BufferSize - (sizeof(struct ip) + sizeof(struct udphdr));
+
+	return(&packet[sizeof(struct ip) + sizeof(struct udphdr)]);
+}
+
+/****************************************************************************/
+
+/* Fill in the IP and UDP headers around the UDP datagram payload which has
+ * been put together in the write request transmission buffer, and which is
+ * data_length bytes long. The UDP datagram will be initialized to use the
+ * given source and destination port numbers. We also calculate both the UDP
+ * and IP datagram checksums so that transmission errors are less likely to
+ * be overlooked.
  *
  * Once the IP and UDP headers have been filled in, and the checksums have
  * been calculated, the entire IP datagram is sent to the TFTP server.
  */
 LONG
+send_udp_payload(int client_port_number,int server_port_number,int data_length)
+{
+	UBYTE * packet = write_request->nior_Buffer;
+	ULONG payload_sum;
+
+	payload_sum = in_cksum_partial(&packet[sizeof(struct ip) + sizeof(struct udphdr)],data_length,0);
+
+	return(send_udp_datagram(client_port_number,server_port_number,data_length,payload_sum));
+}
+
+/****************************************************************************/
+
+/* Send a UDP datagram whose payload is stored somewhere else. The payload
+ * is copied into the transmission buffer and its checksum is calculated
+ * on the way, so that it has to be read only once.
+ */
+LONG
 send_udp(int client_port_number,int server_port_number,const void * data,int data_length)
 {
+	ULONG payload_sum;
+
+	payload_sum = in_cksum_copy(get_udp_payload_buffer(NULL), data, data_length, 0);
+
+	num_udp_bytes_copied += data_length;
+
+	return(send_udp_datagram(client_port_number,server_port_number,data_length,payload_sum));
+}
+
+/****************************************************************************/
+
+/* This does the work for send_udp_payload() and send_udp(), with the
+ * checksum of the payload already calculated. The headers are copied
+ * from the template, and the checksums are completed by adding the
+ * lengths to the sums of the fixed parts.
+ */
+LONG
+send_udp_datagram(int client_port_number,int server_port_number,int data_length,ULONG payload_sum)
+{
+	const struct udp_header_template * uht;
 	UBYTE * packet = write_request->nior_Buffer;
 	struct udphdr * udp;
 	struct ip * ip;
-	struct udp_pseudo_header * udp_pseudo_header;
 	LONG error;
+	ULONG sum;
 	int len;
 
 	ENTER();
 
 	ASSERT( write_request->nior_BufferSize > 540 );
-	ASSERT( data_length <= write_request->nior_BufferSize );
+	ASSERT( sizeof(*ip) + sizeof(*udp) + data_length <= write_request->nior_BufferSize );
 
-	/* Set the entire buffer contents to 0 because the
-	 * UDP payload length may not be an even number. In
-	 * this case a padding byte may have to be added,
-	 * and it should be set to 0.
-	 */
-	memset(packet,0,write_request->nior_BufferSize);
+	uht = get_udp_header_template(client_port_number,server_port_number);
 
 	ip = (struct ip *)packet;
 	udp = (struct udphdr *)&ip[1];
 
-	/* Fill in the UDP datagram payload. */
-	memmove(&udp[1], data, data_length);
-
-	len = data_length;
+	/* Structure copies. */
+	(*ip)	= uht->uht_IP;
+	(*udp)	= uht->uht_UDP;
 
 	/*
-	 * Set up the UDP contents.
+	 * Set up the UDP contents. The length counts twice,
+	 * once in the pseudo header and once in the UDP header.
+	 * If the datagram length is an odd number, the payload
+	 * checksum was padded with a zero byte.
 	 */
 
-	/* The datagram length must be even. */
-	if ((len % 2) != 0)
-		len++;
+	len = sizeof(*udp) + data_length;
 
-	len += sizeof(*udp);
+	udp->uh_ulen = len;
 
-	udp->uh_sport	= client_port_number;
-	udp->uh_dport	= server_port_number;
-	udp->uh_ulen	= len;
-	udp->uh_sum		= 0;
+	sum = uht->uht_PseudoHeaderSum;
+
+	ADD_WITH_CARRY(sum,payload_sum);
+	ADD_WITH_CARRY(sum,len);
+	ADD_WITH_CARRY(sum,len);
+
+	/* A checksum of 0 means that there is none (RFC 768). */
+	udp->uh_sum = in_cksum_fold(sum);
+	if(udp->uh_sum == 0)
+		udp->uh_sum = 0xffff;
 
-	/* The following initialization is needed for the UDP
-	 * datagram checksum to be calculated correctly. The
-	 * checksum is calculated using information found in
-	 * the IPv4 header, which is partly filled in here, too.
-	 */
-	udp_pseudo_header = (struct udp_pseudo_header *)ip;
-	udp_pseudo_header->ip_zero1[0] = udp_pseudo_header->ip_zero1[1] = 0;
-	udp_pseudo_header->ip_zero2 = 0;
-
-	udp_pseudo_header->ip_pr	= IPPROTO_UDP;
-	udp_pseudo_header->ip_src	= local_ipv4_address;
-	udp_pseudo_header->ip_dst	= remote_ipv4_address;
-	udp_pseudo_header->ip_len	= udp_pseudo_header->uh_ulen;
-	
-	udp->uh_sum = in_cksum(ip,sizeof(*ip) + udp_pseudo_header->uh_ulen);
-	
 	/*
 	 * Set up the IPv4 header and its checksum.
 	 */
 
 	len += sizeof(*ip);
 
-	ip->ip_v_hl	= (IPVERSION << 4) | 5;
-	ip->ip_len	= len;
-	ip->ip_ttl	= 64;
-	ip->ip_pr	= IPPROTO_UDP;
-	ip->ip_sum	= 0;
-	ip->ip_sum	= in_cksum(ip, sizeof(*ip));
+	ip->ip_len = len;
+
+	sum = uht->uht_IPHeaderSum;
+
+	ADD_WITH_CARRY(sum,len);
+
+	ip->ip_sum = in_cksum_fold(sum);
 
 	ASSERT( len <= write_request->nior_BufferSize );
 
@@ -403,6 +819,8 @@ send_udp(int client_port_number,int server_port_number,const void * data,int dat
 
 	memmove(write_request->nior_IOS2.ios2_DstAddr,remote_ethernet_address,sizeof(remote_ethernet_address));
 
+	num_udp_datagrams_sent++;
+
 	#if defined(TESTING)
 	{
 		if(0 < drop_tx && (rand() % 100) < drop_tx)
@@ -429,9 +847,12 @@ send_udp(int client_port_number,int server_port_number,const void * data,int dat
 	}
 	#endif /* TESTING */
 
-	ASSERT( NOT write_request->nior_InUse );
+	/* The driver will let us know if the datagram could
+	 * not be sent, through get_transmit_error().
+	 */
+	send_write_request();
 
-	error = DoIO((struct IORequest *)write_request);
+	error = OK;
 
 	RETURN(error);
 	return(error);
@@ -444,38 +865,50 @@ send_udp(int client_port_number,int server_port_number,const void * data,int dat
  * header, the UDP datagram header itself, and the UDP datagram payload.
  * If correct, the checksum should be 0.
  *
- * Please note that this function may write to the IP datagram header in order
- * to simplify the checksum calculation. The contents of the IP datagram
- * header will be restored after they have been changed, though.
+ * If the network driver copied the datagram into the read request buffer,
+ * the checksum of everything following the IP header was calculated while
+ * copying. Either way, the pseudo header is not put together in memory;
+ * its fields are added to the checksum instead, which leaves the datagram
+ * untouched.
  */
 int
-verify_udp_datagram_checksum(struct ip * ip)
+verify_udp_datagram_checksum(const struct ip * ip,const struct NetIORequest * read_request)
 {
-	struct udphdr * udp = (struct udphdr *)&ip[1];
+	const struct udphdr * udp = (const struct udphdr *)&ip[1];
 	int checksum;
+	ULONG sum;
 
 	ASSERT( ip != NULL );
 
-	/* If this UDP datagram has a checksum, verify it. */
-	if(udp->uh_sum != 0)
+	/* If this UDP datagram has a checksum, verify it. It must
+	 * not cover more than was received, though.
+	 */
+	if(udp->uh_sum != 0 && read_request != NULL && sizeof(*ip) + (UWORD)udp->uh_ulen > read_request->nior_IOS2.ios2_DataLength)
 	{
-		struct udp_pseudo_header * udp_pseudo_header;
-		struct ip ip_copy;
-
-		/* We will clobber the IP header for the calculation,
-		 * so let's save it first (structure copy).
+		checksum = -1;
+	}
+	else if (udp->uh_sum != 0)
+	{
+		/* The sum calculated while copying only covers the
+		 * UDP datagram if nothing else followed it in the
+		 * frame, e.g. padding.
 		 */
-		ip_copy = (*ip);
-
-		udp_pseudo_header = (struct udp_pseudo_header *)ip;
-		udp_pseudo_header->ip_zero1[0] = udp_pseudo_header->ip_zero1[1] = 0;
-		udp_pseudo_header->ip_zero2 = 0;
-		udp_pseudo_header->ip_len = udp_pseudo_header->uh_ulen;
+		if(read_request != NULL && read_request->nior_PayloadSumValid &&
+		   (ip->ip_v_hl & 0x0f) == 5 && sizeof(*ip) + (UWORD)udp->uh_ulen == read_request->nior_IOS2.ios2_DataLength)
+		{
+			sum = read_request->nior_PayloadSum;
+		}
+		else
+		{
+			sum = in_cksum_partial(udp,(UWORD)udp->uh_ulen,0);
+		}
 
-		checksum = in_cksum(ip,sizeof(*ip) + udp_pseudo_header->uh_ulen);
+		ADD_WITH_CARRY(sum,ip->ip_src);
+		ADD_WITH_CARRY(sum,ip->ip_dst);
+		ADD_WITH_CARRY(sum,ip->ip_pr);
+		ADD_WITH_CARRY(sum,(UWORD)udp->uh_ulen);
 
-		/* Restore the damage (structure copy). */
-		(*ip) = ip_copy;
+		checksum = in_cksum_fold(sum);
 	}
 	/* Otherwise accept it as is. */
 	else
@@ -86,26 +86,6 @@ struct ip
 
 /****************************************************************************/
 
-/* Combined IP and UDP headers, suitable for calculating
- * and verifying the UDP datagram checksum.
- */
-struct udp_pseudo_header
-{
-	ULONG	ip_zero1[2];	/* set to zero; this covers ip_v_hl..ip_off */
-	UBYTE	ip_zero2;		/* set to zero; this covers ip_ttl */
-	UBYTE	ip_pr;			/* protocol */
-	UWORD	ip_len;			/* protocol length; this covers ip_sum */
-	ULONG	ip_src;			/* source internet address; this covers ip_src */
-	ULONG	ip_dst;			/* destination internet address; this covers ip_dst */
-
-	UWORD	uh_sport;		/* source port */
-	UWORD	uh_dport;		/* destination port */
-	WORD	uh_ulen;		/* udp length */
-	UWORD	uh_sum;			/* udp checksum */
-};
-
-/****************************************************************************/
-
 /* Basic ICMP header; there may be other data following it.  */
 struct icmp_header
 {
@@ -147,12 +127,31 @@ enum icmp_errors_and_codes
 
 /****************************************************************************/
 
+struct NetIORequest;
+
+/****************************************************************************/
+
+extern ULONG num_udp_datagrams_sent;
+extern ULONG num_udp_bytes_copied;
+
+/****************************************************************************/
+
+extern ULONG in_cksum_partial (const void * addr, int len, ULONG sum);
+extern ULONG in_cksum_copy (void * to, const void * from, int len, ULONG sum);
+extern int in_cksum_fold (ULONG sum);
 extern int in_cksum (const void * addr, int len);
 extern int inet_aton(const char *cp, unsigned long * addr);
+extern UBYTE * get_udp_payload_buffer(int * max_length_ptr);
+extern LONG send_udp_payload(int client_port_number,int server_port_number,int data_length);
+extern LONG send_udp_datagram(int client_port_number,int server_port_number,int data_length,ULONG payload_sum);
 extern LONG send_udp(int client_port_number,int server_port_number,const void * data,int data_length);
-extern int verify_udp_datagram_checksum(struct ip * ip);
+extern int verify_udp_datagram_checksum(const struct ip * ip,const struct NetIORequest * read_request);
 extern void get_ipv4_address_and_path_from_name(STRPTR name, ULONG * ipv4_address, STRPTR * path_name);
 
+#if defined(TESTING)
+extern int reference_in_cksum (const void * addr, int len);
+#endif /* TESTING */
+
 /****************************************************************************/
 
 #endif /* _NETWORK_IP_UDP_H */
@@ -39,6 +39,8 @@
 
 #include <stddef.h>
 #include <string.h>
+#include <stdio.h>
+#include <ctype.h>
 
 /****************************************************************************/
 
@@ -47,39 +49,37 @@
 
 /****************************************************************************/
 
+#include "macros.h"
 #include "assert.h"
 
 /****************************************************************************/
 
-/* Send a TFTP acknowledgement packet to the remote server. Note that the
- * contents of the buffer pointed to by the tftp_packet parameter will be modified.
+/* Send a TFTP acknowledgement packet to the remote server. The packet is
+ * put together in the transmission buffer, as are all the packets below.
  */
 LONG
-send_tftp_acknowledgement(int block_number,int client_port_number,int server_port_number,UBYTE * tftp_packet)
+send_tftp_acknowledgement(int block_number,int client_port_number,int server_port_number)
 {
-	struct tftphdr * th = (struct tftphdr *)tftp_packet;
-
-	ASSERT( tftp_packet != NULL );
+	struct tftphdr * th = (struct tftphdr *)get_udp_payload_buffer(NULL);
 
 	th->th_opcode	= TFTP_PACKET_ACK;
 	th->th_block	= block_number;
 
-	return(send_udp(client_port_number,server_port_number,tftp_packet,(int)offsetof(struct tftphdr, th_data)));
+	/* The checksum of the two 16 bit words is their sum. */
+	return(send_udp_datagram(client_port_number,server_port_number,(int)offsetof(struct tftphdr, th_data),
+		(ULONG)TFTP_PACKET_ACK + (UWORD)block_number));
 }
 
 /****************************************************************************/
 
-/* Send a TFTP error packet to the remote server. Note that the contents of the buffer
- * pointed to by the tftp_packet parameter will be modified.
- */
+/* Send a TFTP error packet to the remote server. */
 LONG
-send_tftp_error(int error_code,STRPTR message,int client_port_number,int server_port_number,UBYTE * tftp_packet)
+send_tftp_error(int error_code,STRPTR message,int client_port_number,int server_port_number)
 {
-	struct tftphdr * th = (struct tftphdr *)tftp_packet;
+	struct tftphdr * th = (struct tftphdr *)get_udp_payload_buffer(NULL);
 	char * msg = th->th_msg;
 
 	ASSERT( message != NULL );
-	ASSERT( tftp_packet != NULL );
 
 	th->th_opcode	= TFTP_PACKET_ERROR;
 	th->th_code		= error_code;
@@ -87,22 +87,99 @@ send_tftp_error(int error_code,STRPTR message,int client_port_number,int server_
 	strcpy(msg,message);
 	msg += strlen(msg)+1;
 
-	return(send_udp(client_port_number,server_port_number,tftp_packet,(int)(msg - (char *)tftp_packet)));
+	return(send_udp_payload(client_port_number,server_port_number,(int)(msg - (char *)th)));
+}
+
+/****************************************************************************/
+
+/* Append a single option name and its value to a read or write request
+ * which is being put together, provided that there is still room left
+ * for it. Returns the address following the option value, or the
+ * unmodified address if the option did not fit.
+ */
+static UBYTE *
+add_tftp_option_text(UBYTE * stuff,const UBYTE * end,const char * name,const char * value)
+{
+	int name_length, value_length;
+
+	ASSERT( stuff != NULL && end != NULL && name != NULL && value != NULL );
+
+	name_length		= strlen(name)+1;
+	value_length	= strlen(value)+1;
+
+	if(stuff + name_length + value_length <= end)
+	{
+		strcpy(stuff,name);
+		stuff += name_length;
+
+		strcpy(stuff,value);
+		stuff += value_length;
+	}
+
+	return(stuff);
+}
+
+/* Same as above, but for an option with a numeric value. */
+static UBYTE *
+add_tftp_option(UBYTE * stuff,const UBYTE * end,const char * name,ULONG value)
+{
+	char number[16];
+
+	sprintf(number,"%lu",value);
+
+	return(add_tftp_option_text(stuff,end,name,number));
+}
+
+/****************************************************************************/
+
+/* Append the options which are set to a read or write request, or to an
+ * option acknowledgement, as far as there is room for them. Returns the
+ * address following the last option added.
+ */
+static UBYTE *
+add_tftp_options(UBYTE * stuff,const UBYTE * end,const struct tftp_options * options)
+{
+	ASSERT( stuff != NULL && end != NULL && options != NULL );
+
+	if(options->to_blksize > 0)
+		stuff = add_tftp_option(stuff,end,"blksize",options->to_blksize);
+
+	if(options->to_windowsize > 0)
+		stuff = add_tftp_option(stuff,end,"windowsize",options->to_windowsize);
+
+	if(options->to_use_tsize)
+		stuff = add_tftp_option(stuff,end,"tsize",options->to_tsize);
+
+	if(options->to_timeout > 0)
+		stuff = add_tftp_option(stuff,end,"timeout",options->to_timeout);
+
+	if(options->to_use_rollover)
+		stuff = add_tftp_option(stuff,end,"rollover",options->to_rollover);
+
+	/* The client asks for multicast delivery without
+	 * suggesting a group (RFC 2090).
+	 */
+	if(options->to_use_multicast)
+		stuff = add_tftp_option_text(stuff,end,"multicast","");
+
+	return(stuff);
 }
 
 /****************************************************************************/
 
 /* Send a message with a request for the remote TFTP server to begin the data transmission.
- * Note that the contents of the buffer pointed to by the tftp_packet parameter will be modified.
+ * The options will be added to the request only if they are provided and fit into the
+ * request packet, which may not be longer than 512 bytes (RFC 2347).
  */
 LONG
-start_tftp(int operation,STRPTR file_name,int client_port_number,int server_port_number,UBYTE * tftp_packet)
+start_tftp(int operation,STRPTR file_name,const struct tftp_options * options,int client_port_number,int server_port_number)
 {
+	UBYTE * tftp_packet = get_udp_payload_buffer(NULL);
 	struct tftphdr * th = (struct tftphdr *)tftp_packet;
+	const UBYTE * end = &tftp_packet[offsetof(struct tftphdr, th_data) + SEGSIZE];
 	UBYTE * stuff;
 
 	ASSERT( file_name != NULL );
-	ASSERT( tftp_packet != NULL );
 
 	th->th_opcode = operation;
 
@@ -114,5 +191,461 @@ start_tftp(int operation,STRPTR file_name,int client_port_number,int server_port
 	strcpy(stuff,"octet");
 	stuff += strlen(stuff)+1;
 
-	return(send_udp(client_port_number,server_port_number,tftp_packet,(int)(stuff - tftp_packet)));
+	if(options != NULL)
+		stuff = add_tftp_options(stuff,end,options);
+
+	return(send_udp_payload(client_port_number,server_port_number,(int)(stuff - tftp_packet)));
+}
+
+/****************************************************************************/
+
+/* Send an option acknowledgement (RFC 2347) in response to a read or write
+ * request, confirming the options which the server has accepted.
+ */
+LONG
+send_tftp_option_acknowledgement(const struct tftp_options * options,int client_port_number,int server_port_number)
+{
+	UBYTE * tftp_packet = get_udp_payload_buffer(NULL);
+	struct tftphdr * th = (struct tftphdr *)tftp_packet;
+	const UBYTE * end = &tftp_packet[offsetof(struct tftphdr, th_data) + SEGSIZE];
+	UBYTE * stuff;
+
+	ASSERT( options != NULL );
+
+	th->th_opcode = TFTP_PACKET_OACK;
+
+	stuff = add_tftp_options(th->th_stuff,end,options);
+
+	return(send_udp_payload(client_port_number,server_port_number,(int)(stuff - tftp_packet)));
+}
+
+/****************************************************************************/
+
+/* Convert a block number into the 16 bit number which is transmitted
+ * in the TFTP packet. Past block 65535 the numbers start over with the
+ * block number given by the "rollover" option.
+ */
+UWORD
+get_wire_block_number(int block_number,int rollover)
+{
+	UWORD result;
+
+	ASSERT( block_number >= 0 );
+	ASSERT( rollover == 0 || rollover == 1 );
+
+	if(block_number <= MAX_WIRE_BLOCK_NUMBER || rollover == 0)
+		result = block_number & 0xFFFF;
+	else
+		result = 1 + ((block_number - 1) % MAX_WIRE_BLOCK_NUMBER);
+
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Figure out which block number the 16 bit number transmitted in a TFTP
+ * packet refers to. This picks the block number closest to the reference
+ * block number, which should be the block number expected next. Note that
+ * the result may be negative, which can never be a valid block number.
+ */
+int
+get_block_number_from_wire(UWORD wire_block_number,int reference_block_number,int rollover)
+{
+	LONG modulus = (rollover == 0) ? 65536 : MAX_WIRE_BLOCK_NUMBER;
+	LONG delta;
+
+	ASSERT( rollover == 0 || rollover == 1 );
+
+	delta = ((LONG)wire_block_number - (LONG)get_wire_block_number(reference_block_number,rollover)) % modulus;
+	if(delta < 0)
+		delta += modulus;
+
+	if(delta >= modulus / 2)
+		delta -= modulus;
+
+	return(reference_block_number + delta);
+}
+
+/****************************************************************************/
+
+/* Compare two strings, ignoring case, which is how TFTP option
+ * names are to be compared. Returns 0 if the strings match.
+ */
+static int
+compare_option_names(const char * a,const char * b)
+{
+	int result = 0;
+
+	ASSERT( a != NULL && b != NULL );
+
+	while(result == 0)
+	{
+		result = tolower((unsigned char)(*a)) - tolower((unsigned char)(*b));
+		if((*a) == '\0' || (*b) == '\0')
+			break;
+
+		a++;
+		b++;
+	}
+
+	return(result);
+}
+
+/* Convert the value of a TFTP option into a number. Returns FAILURE
+ * if the value is not a decimal number or if it is out of range.
+ */
+static int
+get_option_value(const char * s,ULONG * value_ptr)
+{
+	int result = FAILURE;
+	ULONG value = 0;
+
+	ASSERT( s != NULL && value_ptr != NULL );
+
+	if((*s) == '\0')
+		goto out;
+
+	while((*s) != '\0')
+	{
+		if(!isdigit((unsigned char)(*s)) || value > (0xFFFFFFFFUL - 9) / 10)
+			goto out;
+
+		value = (value * 10) + (*s++) - '0';
+	}
+
+	(*value_ptr) = value;
+
+	result = OK;
+
+ out:
+
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Copy the next comma-separated field of an option value into a buffer.
+ * Returns the address following the comma, or NULL if there is no comma
+ * or the field does not fit into the buffer.
+ */
+static const char *
+get_option_field(const char * s,char * field,size_t field_size)
+{
+	const char * comma;
+	size_t length;
+
+	ASSERT( s != NULL && field != NULL && field_size > 0 );
+
+	comma = strchr(s,',');
+	if(comma == NULL)
+		return(NULL);
+
+	length = comma - s;
+	if(length >= field_size)
+		return(NULL);
+
+	memmove(field,s,length);
+	field[length] = '\0';
+
+	return(comma + 1);
+}
+
+/* Convert the value of the "multicast" option, which consists of the
+ * group address, the UDP port number and the master client flag, all
+ * separated by commas (RFC 2090). The address and the port number may
+ * be empty if they have not changed since the last option
+ * acknowledgement, in which case they are set to 0. Returns FAILURE if
+ * the value cannot be used.
+ */
+static int
+get_multicast_option_value(const char * s,struct tftp_options * options)
+{
+	int result = FAILURE;
+	char field[20];
+	unsigned long ipv4_address;
+	ULONG number;
+
+	ASSERT( s != NULL && options != NULL );
+
+	options->to_multicast_address	= 0;
+	options->to_multicast_port		= 0;
+
+	/* The group must be a class D address. */
+	s = get_option_field(s,field,sizeof(field));
+	if(s == NULL)
+		goto out;
+
+	if(field[0] != '\0')
+	{
+		if(!inet_aton(field,&ipv4_address) || (ipv4_address & 0xF0000000UL) != 0xE0000000UL)
+			goto out;
+
+		options->to_multicast_address = ipv4_address;
+	}
+
+	s = get_option_field(s,field,sizeof(field));
+	if(s == NULL)
+		goto out;
+
+	if(field[0] != '\0')
+	{
+		if(get_option_value(field,&number) != OK || number == 0 || number > 65535)
+			goto out;
+
+		options->to_multicast_port = number;
+	}
+
+	if(get_option_value(s,&number) != OK || number > 1)
+		goto out;
+
+	options->to_master_client = number;
+
+	result = OK;
+
+ out:
+
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Process the option acknowledgement (OACK) which the server sent in response
+ * to the read or write request. Each option in the acknowledgement must have
+ * been requested before, and its value must be acceptable. Options which the
+ * server ignored will be set to 0 in the "accepted" set of options.
+ *
+ * Returns OK if the option acknowledgement is acceptable, and FAILURE
+ * otherwise, in which case the transfer should be aborted with a
+ * TFTP_ERROR_OPTION error.
+ */
+int
+parse_tftp_option_acknowledgement(const struct tftphdr * tftp,int length,const struct tftp_options * requested,struct tftp_options * accepted)
+{
+	const char * stuff = (const char *)tftp->th_stuff;
+	const char * end = &((const char *)tftp)[length];
+	const char * name;
+	const char * value;
+	int result = FAILURE;
+	ULONG number;
+
+	ASSERT( tftp != NULL && requested != NULL && accepted != NULL );
+
+	memset(accepted,0,sizeof(*accepted));
+
+	/* The option names and values are stored as pairs of
+	 * NUL-terminated strings, which must not extend beyond
+	 * the end of the packet.
+	 */
+	while(stuff < end)
+	{
+		name = stuff;
+
+		while(stuff < end && (*stuff) != '\0')
+			stuff++;
+
+		if(stuff == end)
+			goto out;
+
+		value = ++stuff;
+
+		while(stuff < end && (*stuff) != '\0')
+			stuff++;
+
+		if(stuff == end)
+			goto out;
+
+		stuff++;
+
+		if(compare_option_names(name,"blksize") == 0)
+		{
+			/* The server may choose a smaller block size than we
+			 * asked for, but not a larger one.
+			 */
+			if(requested->to_blksize == 0 || get_option_value(value,&number) != OK ||
+			   number < MIN_BLKSIZE || number > (ULONG)requested->to_blksize)
+			{
+				goto out;
+			}
+
+			accepted->to_blksize = number;
+		}
+		else if (compare_option_names(name,"windowsize") == 0)
+		{
+			/* The server may choose a smaller window size than
+			 * we asked for, but not a larger one.
+			 */
+			if(requested->to_windowsize == 0 || get_option_value(value,&number) != OK ||
+			   number < 1 || number > (ULONG)requested->to_windowsize)
+			{
+				goto out;
+			}
+
+			accepted->to_windowsize = number;
+		}
+		else if (compare_option_names(name,"tsize") == 0)
+		{
+			/* For a read request the server will tell us how large
+			 * the file is. For a write request it should just
+			 * repeat the size we sent.
+			 */
+			if(NOT requested->to_use_tsize || get_option_value(value,&number) != OK)
+				goto out;
+
+			accepted->to_use_tsize	= TRUE;
+			accepted->to_tsize		= number;
+		}
+		else if (compare_option_names(name,"timeout") == 0)
+		{
+			/* The server has to accept the timeout exactly as
+			 * requested, or not at all.
+			 */
+			if(requested->to_timeout == 0 || get_option_value(value,&number) != OK ||
+			   number != (ULONG)requested->to_timeout)
+			{
+				goto out;
+			}
+
+			accepted->to_timeout = number;
+		}
+		else if (compare_option_names(name,"rollover") == 0)
+		{
+			/* The server may tell us which block number follows
+			 * block 65535, which can only be 0 or 1.
+			 */
+			if(NOT requested->to_use_rollover || get_option_value(value,&number) != OK || number > 1)
+				goto out;
+
+			accepted->to_use_rollover	= TRUE;
+			accepted->to_rollover		= number;
+		}
+		else if (compare_option_names(name,"multicast") == 0)
+		{
+			/* The server tells us where the data blocks will be
+			 * sent to, and whether we have to acknowledge them.
+			 */
+			if(NOT requested->to_use_multicast || get_multicast_option_value(value,accepted) != OK)
+				goto out;
+
+			accepted->to_use_multicast = TRUE;
+		}
+		/* We didn't ask for this option, so the server must not acknowledge it. */
+		else
+		{
+			goto out;
+		}
+	}
+
+	result = OK;
+
+ out:
+
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Process a read or write request which a client sent to the server. The
+ * request consists of the file name, the transfer mode and the options
+ * which the client would like to use, all of them NUL-terminated strings.
+ * Only the "octet" transfer mode is supported. Options which are unknown
+ * or which have unusable values are ignored (RFC 2347); the others will
+ * be stored in the "requested" set of options.
+ *
+ * Returns OK if the request is acceptable, and FAILURE otherwise. The file
+ * name returned points into the request packet.
+ */
+int
+parse_tftp_request(const struct tftphdr * tftp,int length,const char ** file_name_ptr,struct tftp_options * requested)
+{
+	const char * stuff = (const char *)tftp->th_stuff;
+	const char * end = &((const char *)tftp)[length];
+	const char * file_name;
+	const char * mode;
+	const char * name;
+	const char * value;
+	int result = FAILURE;
+	ULONG number;
+
+	ASSERT( tftp != NULL && file_name_ptr != NULL && requested != NULL );
+
+	memset(requested,0,sizeof(*requested));
+
+	file_name = stuff;
+
+	while(stuff < end && (*stuff) != '\0')
+		stuff++;
+
+	if(stuff == end || stuff == file_name)
+		goto out;
+
+	mode = ++stuff;
+
+	while(stuff < end && (*stuff) != '\0')
+		stuff++;
+
+	if(stuff == end || compare_option_names(mode,"octet") != 0)
+		goto out;
+
+	stuff++;
+
+	while(stuff < end)
+	{
+		name = stuff;
+
+		while(stuff < end && (*stuff) != '\0')
+			stuff++;
+
+		if(stuff == end)
+			break;
+
+		value = ++stuff;
+
+		while(stuff < end && (*stuff) != '\0')
+			stuff++;
+
+		if(stuff == end)
+			break;
+
+		stuff++;
+
+		if(get_option_value(value,&number) != OK)
+			continue;
+
+		if(compare_option_names(name,"blksize") == 0)
+		{
+			if(MIN_BLKSIZE <= number && number <= MAX_BLKSIZE)
+				requested->to_blksize = number;
+		}
+		else if (compare_option_names(name,"windowsize") == 0)
+		{
+			if(1 <= number && number <= MAX_WIRE_BLOCK_NUMBER)
+				requested->to_windowsize = number;
+		}
+		else if (compare_option_names(name,"tsize") == 0)
+		{
+			requested->to_use_tsize	= TRUE;
+			requested->to_tsize		= number;
+		}
+		else if (compare_option_names(name,"timeout") == 0)
+		{
+			if(1 <= number && number <= 255)
+				requested->to_timeout = number;
+		}
+		else if (compare_option_names(name,"rollover") == 0)
+		{
+			if(number <= 1)
+			{
+				requested->to_use_rollover	= TRUE;
+				requested->to_rollover		= number;
+			}
+		}
+	}
+
+	(*file_name_ptr) = file_name;
+
+	result = OK;
+
+ out:
+
+	return(result);
 }
@@ -57,12 +57,49 @@
 
 #define SEGSIZE 512	/* data segment size */
 
+/* Block size limits, per RFC 2348. */
+#define MIN_BLKSIZE	8
+#define MAX_BLKSIZE	65464
+
+/* Number of data blocks which may be in flight before an acknowledgement
+ * is required (RFC 7440). The protocol permits up to 65535 blocks, but
+ * we have to keep all of them in memory.
+ */
+#define DEFAULT_WINDOWSIZE	4
+#define MAX_WINDOWSIZE		64
+
+/* How many files may be transferred at the same time. Each transfer
+ * is a TFTP session of its own, with its own UDP port number.
+ */
+#define DEFAULT_SESSIONS	4
+#define MAX_SESSIONS		16
+
+/* Only the lower 16 bits of the block number are transmitted. After
+ * block 65535 the numbers start over with either 0 or 1, depending upon
+ * the "rollover" option.
+ */
+#define MAX_WIRE_BLOCK_NUMBER	65535
+
+/* How long to wait for the server to respond before sending a packet
+ * again, in milliseconds. The server will be asked to use the same
+ * timeout, rounded up to full seconds (RFC 2349 permits 1..255 seconds).
+ */
+#define DEFAULT_TIMEOUT		250
+#define MIN_TIMEOUT			10
+#define MAX_TIMEOUT			255000
+
+/* When serving files, we give up on a client which does not respond
+ * after this many retransmissions in a row.
+ */
+#define MAX_SERVER_RETRANSMISSIONS	8
+
 /* Packet types */
 #define	TFTP_PACKET_RRQ		1	/* read request */
 #define	TFTP_PACKET_WRQ		2	/* write request */
 #define	TFTP_PACKET_DATA	3	/* data packet */
 #define	TFTP_PACKET_ACK		4	/* acknowledgement */
 #define	TFTP_PACKET_ERROR	5	/* error code */
+#define	TFTP_PACKET_OACK	6	/* option acknowledgement (RFC 2347) */
 
 struct tftphdr
 {
@@ -92,12 +129,44 @@ struct tftphdr
 #define	TFTP_ERROR_BADID	5	/* unknown transfer ID */
 #define	TFTP_ERROR_EXISTS	6	/* file already exists */
 #define	TFTP_ERROR_NOUSER	7	/* no such user */
+#define	TFTP_ERROR_OPTION	8	/* option negotiation failed (RFC 2347) */
+
+/****************************************************************************/
+
+/* The TFTP options which the client may ask for when it sends the read or
+ * write request, and which the server may confirm in its option
+ * acknowledgement (RFC 2347). An option which is set to 0 will not be
+ * requested, or was not acknowledged, respectively. Since a transfer
+ * size of 0 is valid, the "tsize" option is controlled by a flag.
+ * The "multicast" option is requested without a value; the server
+ * responds with the group address and port number to use, either of
+ * which may be left out (and will then be 0) if it has not changed.
+ */
+struct tftp_options
+{
+	int		to_blksize;		/* Data block size in bytes (RFC 2348) */
+	int		to_windowsize;	/* Number of blocks per window (RFC 7440) */
+	int		to_timeout;		/* Retransmission timeout in seconds (RFC 2349) */
+	BOOL	to_use_rollover;	/* Whether the rollover option is used */
+	int		to_rollover;	/* Block number which follows 65535 (0 or 1) */
+	BOOL	to_use_tsize;	/* Whether the transfer size is used */
+	ULONG	to_tsize;		/* Transfer size in bytes (RFC 2349) */
+	BOOL	to_use_multicast;	/* Whether the multicast option is used (RFC 2090) */
+	ULONG	to_multicast_address;	/* IPv4 address of the multicast group */
+	int		to_multicast_port;	/* UDP port number the group receives on */
+	BOOL	to_master_client;	/* Whether this client acknowledges the blocks */
+};
 
 /****************************************************************************/
 
-extern LONG send_tftp_acknowledgement(int block_number,int client_port_number,int server_port_number,UBYTE * tftp_packet);
-extern LONG send_tftp_error(int error_code,STRPTR message,int client_port_number,int server_port_number,UBYTE * tftp_packet);
-extern LONG start_tftp(int operation,STRPTR file_name,int client_port_number,int server_port_number,UBYTE * tftp_packet);
+extern LONG send_tftp_acknowledgement(int block_number,int client_port_number,int server_port_number);
+extern LONG send_tftp_error(int error_code,STRPTR message,int client_port_number,int server_port_number);
+extern LONG start_tftp(int operation,STRPTR file_name,const struct tftp_options * options,int client_port_number,int server_port_number);
+extern LONG send_tftp_option_acknowledgement(const struct tftp_options * options,int client_port_number,int server_port_number);
+extern UWORD get_wire_block_number(int block_number,int rollover);
+extern int get_block_number_from_wire(UWORD wire_block_number,int reference_block_number,int rollover);
+extern int parse_tftp_option_acknowledgement(const struct tftphdr * tftp,int length,const struct tftp_options * requested,struct tftp_options * accepted);
+extern int parse_tftp_request(const struct tftphdr * tftp,int length,const char ** file_name_ptr,struct tftp_options * requested);
 
 /****************************************************************************/
 
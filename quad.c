@@ -0,0 +1,140 @@
+/*
+ * :ts=4
+ *
+ * TFTP client program for the Amiga, using only the SANA-II network
+ * device driver API, and no TCP/IP stack
+ *
+ * The "trivial file transfer protocol" is anything but trivial
+ * to implement...
+ *
+ * Copyright  2016 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE. MY CAPS LOCK KEY SEEMS TO BE STUCK.
+ */
+
+#include "quad.h"
+
+/****************************************************************************/
+
+#include "macros.h"
+#include "assert.h"
+
+/****************************************************************************/
+
+/* The compiler does not support 64 bit integers, which is why the byte
+ * counters use the same representation as the SANA-II statistics.
+ * These functions take care of the arithmetic.
+ */
+
+/****************************************************************************/
+
+/* Add a 32 bit value to a 64 bit number. */
+void
+add_to_quad(S2QUAD * q,ULONG value)
+{
+	ULONG old_low;
+
+	ASSERT( q != NULL );
+
+	old_low = q->s2q_Low;
+
+	q->s2q_Low += value;
+
+	/* Did the lower 32 bits overflow? */
+	if(q->s2q_Low < old_low)
+		q->s2q_High++;
+}
+
+/****************************************************************************/
+
+/* Add one 64 bit number to another. */
+void
+add_quads(S2QUAD * sum,const S2QUAD * q)
+{
+	ASSERT( sum != NULL && q != NULL );
+
+	add_to_quad(sum,q->s2q_Low);
+
+	sum->s2q_High += q->s2q_High;
+}
+
+/****************************************************************************/
+
+/* Check if a 64 bit number is equal to a 32 bit value. */
+BOOL
+quad_equals(const S2QUAD * q,ULONG value)
+{
+	ASSERT( q != NULL );
+
+	return((BOOL)(q->s2q_High == 0 && q->s2q_Low == value));
+}
+
+/****************************************************************************/
+
+/* Convert a 64 bit number into a decimal string, which must be able to
+ * hold at least QUAD_STRING_SIZE characters. The number is split into
+ * four 16 bit digits which are divided by 10 one after the other, so that
+ * the intermediate results always fit into 32 bits. Returns a pointer to
+ * the start of the string.
+ */
+STRPTR
+convert_quad_to_string(const S2QUAD * q,char * buffer)
+{
+	char * s = &buffer[QUAD_STRING_SIZE-1];
+	ULONG digits[4];
+	ULONG remainder;
+	ULONG n;
+	int i;
+
+	ASSERT( q != NULL && buffer != NULL );
+
+	digits[0] = q->s2q_High >> 16;
+	digits[1] = q->s2q_High & 0xFFFF;
+	digits[2] = q->s2q_Low >> 16;
+	digits[3] = q->s2q_Low & 0xFFFF;
+
+	(*s) = '\0';
+
+	do
+	{
+		remainder = 0;
+
+		for(i = 0 ; i < 4 ; i++)
+		{
+			n = (remainder << 16) | digits[i];
+
+			digits[i]	= n / 10;
+			remainder	= n % 10;
+		}
+
+		(*--s) = '0' + remainder;
+	}
+	while((digits[0] | digits[1] | digits[2] | digits[3]) != 0);
+
+	return(s);
+}
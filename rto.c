@@ -0,0 +1,182 @@
+/*
+ * :ts=4
+ *
+ * TFTP client program for the Amiga, using only the SANA-II network
+ * device driver API, and no TCP/IP stack
+ *
+ * The "trivial file transfer protocol" is anything but trivial
+ * to implement...
+ *
+ * Copyright  2016 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE. MY CAPS LOCK KEY SEEMS TO BE STUCK.
+ */
+
+#include "timer.h"
+#include "rto.h"
+
+/****************************************************************************/
+
+#include "macros.h"
+#include "assert.h"
+
+/****************************************************************************/
+
+/* Clamp the retransmission timeout to the permitted range. */
+static ULONG
+clamp_rto(const struct rto_estimator * re,ULONG rto)
+{
+	if(rto < RTO_MIN)
+		rto = RTO_MIN;
+	else if (rto > re->re_max_rto)
+		rto = re->re_max_rto;
+
+	return(rto);
+}
+
+/****************************************************************************/
+
+/* Set up the estimator, which will use the initial timeout until
+ * the first round trip time has been measured.
+ */
+void
+rto_init(struct rto_estimator * re,ULONG initial_rto)
+{
+	ASSERT( re != NULL );
+
+	re->re_srtt			= 0;
+	re->re_rttvar		= 0;
+	re->re_have_sample	= FALSE;
+	re->re_timing		= FALSE;
+
+	/* The backoff must be able to go beyond the initial timeout. */
+	re->re_max_rto = RTO_MAX;
+	if(re->re_max_rto < initial_rto)
+		re->re_max_rto = initial_rto;
+
+	re->re_rto = clamp_rto(re,initial_rto);
+}
+
+/****************************************************************************/
+
+/* Update the estimator with a new round trip time measurement, in
+ * milliseconds. The caller has to make sure that the measurement does
+ * not involve a packet which was sent more than once, since it would
+ * be impossible to tell which copy was answered (Karn's rule).
+ */
+void
+rto_sample(struct rto_estimator * re,ULONG rtt)
+{
+	LONG delta;
+
+	ASSERT( re != NULL );
+
+	if(NOT re->re_have_sample)
+	{
+		/* srtt = rtt, rttvar = rtt / 2 */
+		re->re_srtt		= rtt << 3;
+		re->re_rttvar	= rtt << 1;
+
+		re->re_have_sample = TRUE;
+	}
+	else
+	{
+		/* srtt = 7/8 srtt + 1/8 rtt */
+		delta = (LONG)rtt - (re->re_srtt >> 3);
+		re->re_srtt += delta;
+
+		/* rttvar = 3/4 rttvar + 1/4 |srtt - rtt| */
+		if(delta < 0)
+			delta = -delta;
+
+		re->re_rttvar += delta - (re->re_rttvar >> 2);
+	}
+
+	/* rto = srtt + 4 * rttvar, which also undoes any backoff. With
+	 * a timer resolution of 1 millisecond the variation must
+	 * count for at least that much.
+	 */
+	re->re_rto = clamp_rto(re,(re->re_srtt >> 3) + (re->re_rttvar > 1 ? re->re_rttvar : 1));
+}
+
+/****************************************************************************/
+
+/* A packet had to be sent again because the timeout elapsed. Double
+ * the timeout, up to the upper limit, until a new round trip time
+ * measurement arrives.
+ */
+void
+rto_backoff(struct rto_estimator * re)
+{
+	ASSERT( re != NULL );
+
+	re->re_rto = clamp_rto(re,re->re_rto * 2);
+}
+
+/****************************************************************************/
+
+/* A packet has just been sent, and the time until the response
+ * arrives will be measured.
+ */
+void
+rto_start_timing(struct rto_estimator * re)
+{
+	ASSERT( re != NULL );
+
+	re->re_start	= get_milliseconds();
+	re->re_timing	= TRUE;
+}
+
+/****************************************************************************/
+
+/* The response to the packet being timed has arrived. */
+void
+rto_stop_timing(struct rto_estimator * re)
+{
+	ASSERT( re != NULL );
+
+	if(re->re_timing)
+	{
+		rto_sample(re,get_milliseconds() - re->re_start);
+
+		re->re_timing = FALSE;
+	}
+}
+
+/****************************************************************************/
+
+/* The packet being timed had to be sent again, which means that the
+ * response can no longer be matched to either copy (Karn's rule).
+ */
+void
+rto_cancel_timing(struct rto_estimator * re)
+{
+	ASSERT( re != NULL );
+
+	re->re_timing = FALSE;
+}
@@ -0,0 +1,87 @@
+/*
+ * :ts=4
+ *
+ * TFTP client program for the Amiga, using only the SANA-II network
+ * device driver API, and no TCP/IP stack
+ *
+ * The "trivial file transfer protocol" is anything but trivial
+ * to implement...
+ *
+ * Copyright  2016 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE. MY CAPS LOCK KEY SEEMS TO BE STUCK.
+ */
+
+#ifndef _RTO_H
+#define _RTO_H
+
+/****************************************************************************/
+
+#ifndef EXEC_TYPES_H
+#include <exec/types.h>
+#endif /* EXEC_TYPES_H */
+
+/****************************************************************************/
+
+/* Limits for the retransmission timeout, in milliseconds. The lower
+ * limit keeps us from flooding the network when the round trip time
+ * is very short, the upper limit keeps the exponential backoff in check.
+ */
+#define RTO_MIN	10
+#define RTO_MAX	16000
+
+/****************************************************************************/
+
+/* The round trip time estimator, following the algorithm which
+ * Van Jacobson proposed for TCP (see RFC 6298). The smoothed round
+ * trip time is stored scaled by 8, the round trip time variation is
+ * stored scaled by 4, so that all calculations can use integers.
+ */
+struct rto_estimator
+{
+	LONG	re_srtt;		/* Smoothed round trip time (x8) */
+	LONG	re_rttvar;		/* Round trip time variation (x4) */
+	ULONG	re_rto;			/* Current retransmission timeout */
+	ULONG	re_max_rto;		/* Upper limit for the backoff */
+	BOOL	re_have_sample;	/* Whether srtt and rttvar are valid */
+	ULONG	re_start;		/* When the packet being timed was sent */
+	BOOL	re_timing;		/* Whether a packet is being timed */
+};
+
+/****************************************************************************/
+
+extern void rto_init(struct rto_estimator * re,ULONG initial_rto);
+extern void rto_sample(struct rto_estimator * re,ULONG rtt);
+extern void rto_backoff(struct rto_estimator * re);
+extern void rto_start_timing(struct rto_estimator * re);
+extern void rto_stop_timing(struct rto_estimator * re);
+extern void rto_cancel_timing(struct rto_estimator * re);
+
+/****************************************************************************/
+
+#endif /* _RTO_H */
@@ -43,6 +43,11 @@
 
 /*#define TESTING*/
 
+/* Check the checksum routines and time them when the program starts.
+ * This only works in combination with TESTING, and it takes a while.
+ */
+/*#define TEST_CKSUM*/
+
 /****************************************************************************/
 
 #if defined(TESTING)
@@ -52,6 +57,20 @@ extern int drop_tx;		/* Probability of a packet to be sent getting dropped inste
 extern int trash_rx;	/* Probability of a packet received getting corrupted. */
 extern int trash_tx;	/* Probability of a packet to be sent getting corrupted instead. */
 
+#if defined(TEST_CKSUM)
+
+/****************************************************************************/
+
+#ifndef _ARGS_H
+#include "args.h"
+#endif /* _ARGS_H */
+
+/****************************************************************************/
+
+extern void test_in_cksum(const struct cmd_args * args);
+
+#endif /* TEST_CKSUM */
+
 #endif /* TESTING */
 
 /****************************************************************************/
@@ -42,6 +42,7 @@
 #define __USE_INLINE__
 #include <proto/exec.h>
 #include <proto/dos.h>
+#include <proto/timer.h>
 
 #include <stdio.h>
 
@@ -64,6 +65,21 @@ struct MsgPort *		time_port;
 struct timerequest *	time_request;
 BOOL					time_in_use;
 
+/* For measuring how long it takes for the server to respond. */
+struct Device *			TimerBase;
+
+/****************************************************************************/
+
+#if defined(__amigaos4__)
+
+/****************************************************************************/
+
+struct TimerIFace *		ITimer;
+
+/****************************************************************************/
+
+#endif /* __amigaos4__ */
+
 /****************************************************************************/
 
 /* Stop the interval timer, if it's currently busy. This function is
@@ -90,11 +106,11 @@ stop_time(void)
 /****************************************************************************/
 
 /* Start the interval timer so that it expires after a given
- * number of seconds. This function is safe to call if the
+ * number of milliseconds. This function is safe to call if the
  * interval timer is currently still ticking.
  */
 void
-start_time(ULONG seconds)
+start_time(ULONG milliseconds)
 {
 	stop_time();
 
@@ -104,8 +120,8 @@ start_time(ULONG seconds)
 	ASSERT( time_request->tr_node.io_Device != NULL );
 
 	time_request->tr_node.io_Command	= TR_ADDREQUEST;
-	time_request->tr_time.tv_secs		= seconds;
-	time_request->tr_time.tv_micro		= 0;
+	time_request->tr_time.tv_secs		= milliseconds / 1000;
+	time_request->tr_time.tv_micro		= (milliseconds % 1000) * 1000;
 
 	SetSignal(0, (1UL << time_port->mp_SigBit));
 
@@ -116,6 +132,24 @@ start_time(ULONG seconds)
 
 /****************************************************************************/
 
+/* Read the system time, in milliseconds. The value wraps around after
+ * about 49 days, which is why only the difference between two readings
+ * is meaningful.
+ */
+ULONG
+get_milliseconds(void)
+{
+	struct timeval tv;
+
+	ASSERT( TimerBase != NULL );
+
+	GetSysTime(&tv);
+
+	return(tv.tv_secs * 1000 + tv.tv_micro / 1000);
+}
+
+/****************************************************************************/
+
 /* This initializes the interval timer. */
 int
 timer_setup(BPTR error_output, const struct cmd_args * args)
@@ -147,7 +181,7 @@ timer_setup(BPTR error_output, const struct cmd_args * args)
 		goto out;
 	}
 
-	error = OpenDevice(TIMERNAME,UNIT_VBLANK,(struct IORequest *)time_request,0);
+	error = OpenDevice(TIMERNAME,UNIT_MICROHZ,(struct IORequest *)time_request,0);
 	if(error != OK)
 	{
 		error_text = get_io_error_text(error);
@@ -158,13 +192,30 @@ timer_setup(BPTR error_output, const struct cmd_args * args)
 		}
 
 		if(!args->Quiet)
-			FPrintf(error_output,"%s: Cannot open \"%s\" unit %ld (%ls).\n","TFTPClient",TIMERNAME,UNIT_VBLANK,error_text);
+			FPrintf(error_output,"%s: Cannot open \"%s\" unit %ld (%ls).\n","TFTPClient",TIMERNAME,UNIT_MICROHZ,error_text);
 
-		D(("Cannot open '%s' unit %ld (%ls).",TIMERNAME,UNIT_VBLANK,error_text));
+		D(("Cannot open '%s' unit %ld (%ls).",TIMERNAME,UNIT_MICROHZ,error_text));
 
 		goto out;
 	}
 
+	TimerBase = time_request->tr_node.io_Device;
+
+	#if defined(__amigaos4__)
+	{
+		ITimer = (struct TimerIFace *)GetInterface((struct Library *)TimerBase, "main", 1, 0);
+		if(ITimer == NULL)
+		{
+			if(!args->Quiet)
+				FPrintf(error_output,"%s: Cannot access \"%s\" interface.\n","TFTPClient",TIMERNAME);
+
+			D(("Cannot access '%s' interface.",TIMERNAME));
+
+			goto out;
+		}
+	}
+	#endif /* __amigaos4__ */
+
 	result = OK;
 
  out:
@@ -180,6 +231,18 @@ timer_cleanup(void)
 {
 	ENTER();
 
+	#if defined(__amigaos4__)
+	{
+		if(ITimer != NULL)
+		{
+			DropInterface((struct Interface *)ITimer);
+			ITimer = NULL;
+		}
+	}
+	#endif /* __amigaos4__ */
+
+	TimerBase = NULL;
+
 	if(time_request != NULL)
 	{
 		stop_time();
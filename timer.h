@@ -61,11 +61,13 @@
 extern struct MsgPort *		time_port;
 extern struct timerequest *	time_request;
 extern BOOL					time_in_use;
+extern struct Device *		TimerBase;
 
 /****************************************************************************/
 
 extern void stop_time(void);
-extern void start_time(ULONG seconds);
+extern void start_time(ULONG milliseconds);
+extern ULONG get_milliseconds(void);
 extern int timer_setup(BPTR error_output, const struct cmd_args * args);
 extern void timer_cleanup(void);
 
@@ -0,0 +1,253 @@
+/*
+ * :ts=4
+ *
+ * TFTP client program for the Amiga, using only the SANA-II network
+ * device driver API, and no TCP/IP stack
+ *
+ * The "trivial file transfer protocol" is anything but trivial
+ * to implement...
+ *
+ * Copyright  2016 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE. MY CAPS LOCK KEY SEEMS TO BE STUCK.
+ */
+
+#define __USE_INLINE__
+#include <proto/exec.h>
+#include <proto/dos.h>
+
+#include <dos/rdargs.h>
+#include <exec/memory.h>
+
+#include <string.h>
+
+/****************************************************************************/
+
+#include "transfer-list.h"
+
+/****************************************************************************/
+
+#include "macros.h"
+#include "assert.h"
+
+/****************************************************************************/
+
+/* Add a file to be transferred to the end of the list. The source and
+ * destination names are copied. Returns OK on success and FAILURE if
+ * there is not enough memory.
+ */
+int
+add_transfer(struct MinList * list,STRPTR source,STRPTR destination)
+{
+	struct transfer_node * tn;
+	int source_size, destination_size;
+	int result = FAILURE;
+
+	ASSERT( list != NULL && source != NULL && destination != NULL );
+
+	source_size			= strlen(source)+1;
+	destination_size	= strlen(destination)+1;
+
+	/* The names are stored right behind the node. */
+	tn = AllocVec(sizeof(*tn) + source_size + destination_size, MEMF_ANY|MEMF_PUBLIC);
+	if(tn == NULL)
+		goto out;
+
+	tn->tn_Source		= (STRPTR)&tn[1];
+	tn->tn_Destination	= &tn->tn_Source[source_size];
+
+	strcpy(tn->tn_Source,source);
+	strcpy(tn->tn_Destination,destination);
+
+	AddTail((struct List *)list,(struct Node *)tn);
+
+	result = OK;
+
+ out:
+
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Read the list of files to be transferred from a file, or from the shell's
+ * input stream if the file name is "*". Each line must contain the names of
+ * the source and destination, in the same form as the FROM and TO command
+ * line parameters would use. Empty lines and lines which begin with ";" or
+ * "#" are ignored. Returns OK on success and FAILURE otherwise, in which
+ * case an error message will have been printed.
+ */
+int
+read_transfer_list(BPTR error_output,const struct cmd_args * args,STRPTR list_name,struct MinList * list)
+{
+	struct
+	{
+		STRPTR	Source;
+		STRPTR	Destination;
+	} line_args;
+
+	TEXT error_message[256];
+	struct RDArgs * rda = NULL;
+	BPTR file = (BPTR)NULL;
+	BPTR input;
+	TEXT line[1024];
+	int result = FAILURE;
+	LONG line_number = 0;
+	int len, i;
+
+	ASSERT( args != NULL && list_name != NULL && list != NULL );
+
+	if(strcmp(list_name,"*") == 0)
+	{
+		input = Input();
+	}
+	else
+	{
+		file = Open(list_name,MODE_OLDFILE);
+		if(file == (BPTR)NULL)
+		{
+			Fault(IoErr(),NULL,error_message,sizeof(error_message));
+
+			if(!args->Quiet)
+				FPrintf(error_output, "%s: Could not open transfer list \"%s\" (%s).\n","TFTPClient",list_name,error_message);
+
+			D(("Could not open transfer list '%s' (%s).",list_name,error_message));
+
+			goto out;
+		}
+
+		input = file;
+	}
+
+	/* Each line is processed by ReadArgs(), just like the
+	 * command line, so that names may be quoted.
+	 */
+	rda = AllocDosObject(DOS_RDARGS,NULL);
+	if(rda == NULL)
+	{
+		if(!args->Quiet)
+			PrintFault(ERROR_NO_FREE_STORE,"TFTPClient");
+
+		goto out;
+	}
+
+	SetIoErr(0);
+
+	while(FGets(input,line,sizeof(line)-1) != NULL)
+	{
+		line_number++;
+
+		/* Skip leading blank spaces. */
+		for(i = 0 ; line[i] == ' ' || line[i] == '\t' ; i++)
+			;
+
+		/* Skip empty lines and comments. */
+		if(line[i] == '\0' || line[i] == '\n' || line[i] == ';' || line[i] == '#')
+			continue;
+
+		/* ReadArgs() expects the line to end with a line feed. */
+		len = strlen(line);
+		if(line[len-1] != '\n')
+		{
+			line[len++] = '\n';
+			line[len] = '\0';
+		}
+
+		rda->RDA_Source.CS_Buffer	= line;
+		rda->RDA_Source.CS_Length	= len;
+		rda->RDA_Source.CS_CurChr	= 0;
+		rda->RDA_Flags				|= RDAF_NOPROMPT;
+
+		memset(&line_args,0,sizeof(line_args));
+
+		if(ReadArgs("FROM/A,TO/A",(LONG *)&line_args,rda) == NULL)
+		{
+			Fault(IoErr(),NULL,error_message,sizeof(error_message));
+
+			if(!args->Quiet)
+				FPrintf(error_output, "%s: Error in line %ld of transfer list \"%s\" (%s).\n","TFTPClient",line_number,list_name,error_message);
+
+			D(("Error in line %ld of transfer list '%s' (%s).",line_number,list_name,error_message));
+
+			goto out;
+		}
+
+		if(add_transfer(list,line_args.Source,line_args.Destination) != OK)
+		{
+			FreeArgs(rda);
+
+			if(!args->Quiet)
+				PrintFault(ERROR_NO_FREE_STORE,"TFTPClient");
+
+			goto out;
+		}
+
+		FreeArgs(rda);
+
+		SetIoErr(0);
+	}
+
+	/* Did the list end because of a read error? */
+	if(IoErr() != 0)
+	{
+		Fault(IoErr(),NULL,error_message,sizeof(error_message));
+
+		if(!args->Quiet)
+			FPrintf(error_output, "%s: Error reading transfer list \"%s\" (%s).\n","TFTPClient",list_name,error_message);
+
+		D(("Error reading transfer list '%s' (%s).",list_name,error_message));
+
+		goto out;
+	}
+
+	result = OK;
+
+ out:
+
+	if(rda != NULL)
+		FreeDosObject(DOS_RDARGS,rda);
+
+	if(file != (BPTR)NULL)
+		Close(file);
+
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Release the memory allocated for all the list entries. */
+void
+free_transfer_list(struct MinList * list)
+{
+	struct Node * node;
+
+	ASSERT( list != NULL );
+
+	while((node = RemHead((struct List *)list)) != NULL)
+		FreeVec(node);
+}